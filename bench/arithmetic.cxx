@@ -0,0 +1,203 @@
+/*
+ * Copyright 2015 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compares evaluating expressions with the bytecode interpreter against a
+// recursive walk over their syntax trees, for growing expressions, and
+// checks that both agree on the value or the first undefined operation of
+// every expression.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+
+#include <string>
+#include <vector>
+
+#include "arithmetic.h"
+
+#define EXPRESSIONS_SIZE 4096
+#define WORK (1 << 24)
+
+static uint64_t random_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// literals_size literals joined by mostly additions and subtractions, with
+// some negations and parentheses. Most literals are small, so most
+// expressions can be evaluated, but about one in large_odds is close to or
+// anywhere up to INT64_MAX, so some overflow, some more than once.
+static void make_expression(std::string& expression, size_t literals_size,
+                            size_t large_odds) {
+    if (literals_size == 1) {
+        if (next_random() % 8 == 0) {
+            expression += '-';
+        }
+        uint64_t literal = next_random() % 10;
+        if (next_random() % large_odds == 0) {
+            literal = next_random() % 2 == 0 ? INT64_MAX - literal
+                : next_random() >> 1;
+        }
+        expression += std::to_string(literal);
+        return;
+    }
+    size_t left_size = 1 + next_random() % (literals_size - 1);
+    bool is_nested = next_random() % 2 == 0;
+    if (is_nested) {
+        expression += '(';
+    }
+    make_expression(expression, left_size, large_odds);
+    uint64_t operation = next_random() % 20;
+    expression += operation < 9 ? " + " : operation < 16 ? " - "
+        : operation < 19 ? " * " : " / ";
+    make_expression(expression, literals_size - left_size, large_odds);
+    if (is_nested) {
+        expression += ')';
+    }
+}
+
+static evaluation_result walk(const syntax_tree& tree, uint32_t index,
+                              int64_t* value) {
+    const node& n = tree.nodes[index];
+    if (n.kind == node_kind::INTEGER_LITERAL) {
+        *value = n.value;
+        return evaluation_result::OK;
+    }
+    int64_t left;
+    evaluation_result result = walk(tree, n.children[0], &left);
+    if (result != evaluation_result::OK) {
+        return result;
+    }
+    if (n.kind == node_kind::NEGATION) {
+        return negate(left, value);
+    }
+    int64_t right;
+    result = walk(tree, n.children[1], &right);
+    if (result != evaluation_result::OK) {
+        return result;
+    }
+    return apply(n.operation, left, right, value);
+}
+
+// value is only meaningful if the result is OK
+static uint64_t summarize(evaluation_result result, int64_t value) {
+    if (result != evaluation_result::OK) {
+        return static_cast<uint64_t>(result) << 32;
+    }
+    return static_cast<uint64_t>(value);
+}
+
+int main() {
+    static const size_t SIZES[] = { 4, 16, 64, 256, 1024 };
+    std::vector<std::string> expressions(EXPRESSIONS_SIZE);
+    std::vector<syntax_tree> trees(EXPRESSIONS_SIZE);
+    std::vector<bytecode> programs(EXPRESSIONS_SIZE);
+    token_stream tokens;
+    syntax_tree tree;
+    bytecode program;
+
+    printf("%8s %16s %16s %16s\n", "literals", "compiled/s", "tree walks/s",
+           "bytecode runs/s");
+    for (size_t s = 0; s < sizeof SIZES / sizeof SIZES[0]; ++s) {
+        size_t literals_size = SIZES[s];
+        for (size_t i = 0; i < EXPRESSIONS_SIZE; ++i) {
+            expressions[i].clear();
+            make_expression(expressions[i], literals_size, literals_size);
+        }
+
+        // without folding, there would be nothing left to evaluate
+        for (size_t i = 0; i < EXPRESSIONS_SIZE; ++i) {
+            const std::string& expression = expressions[i];
+            if (!lex(expression.data(), expression.size(), tokens)
+                || !parse(tokens, trees[i], false)) {
+                fprintf(stderr, "%s does not parse\n", expression.c_str());
+                return EXIT_FAILURE;
+            }
+            compile(trees[i], programs[i]);
+        }
+
+        // into the same tree and program, as a caller that runs each
+        // expression right away would
+        double start = now();
+        for (size_t i = 0; i < EXPRESSIONS_SIZE; ++i) {
+            const std::string& expression = expressions[i];
+            lex(expression.data(), expression.size(), tokens);
+            parse(tokens, tree, false);
+            compile(tree, program);
+        }
+        double compiled = EXPRESSIONS_SIZE / (now() - start);
+
+        size_t repeats = WORK / (EXPRESSIONS_SIZE * literals_size) + 1;
+        // the results are folded in so they are used
+        uint64_t checksum = 0;
+        start = now();
+        for (size_t r = 0; r < repeats; ++r) {
+            for (size_t i = 0; i < EXPRESSIONS_SIZE; ++i) {
+                int64_t value = 0;
+                evaluation_result result =
+                    walk(trees[i], trees[i].root, &value);
+                checksum ^= summarize(result, value);
+            }
+        }
+        double walks = repeats * EXPRESSIONS_SIZE / (now() - start);
+
+        start = now();
+        for (size_t r = 0; r < repeats; ++r) {
+            for (size_t i = 0; i < EXPRESSIONS_SIZE; ++i) {
+                int64_t value = 0;
+                evaluation_result result = evaluate(programs[i], &value);
+                checksum ^= summarize(result, value);
+            }
+        }
+        double runs = repeats * EXPRESSIONS_SIZE / (now() - start);
+
+        printf("%8zu %16.0f %16.0f %16.0f\n", literals_size, compiled, walks,
+               runs);
+
+        // every expression is checked on its own, outside the timing
+        for (size_t i = 0; i < EXPRESSIONS_SIZE; ++i) {
+            int64_t walked = 0;
+            int64_t run = 0;
+            evaluation_result walk_result =
+                walk(trees[i], trees[i].root, &walked);
+            evaluation_result run_result = evaluate(programs[i], &run);
+            if (walk_result != run_result
+                || (walk_result == evaluation_result::OK && walked != run)) {
+                fprintf(stderr, "%s evaluated differently\n",
+                        expressions[i].c_str());
+                return EXIT_FAILURE;
+            }
+        }
+        if (checksum != 0) {
+            fprintf(stderr, "%zu literals checksum mismatch\n",
+                    literals_size);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
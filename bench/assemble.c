@@ -0,0 +1,519 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/* Runs the assembler over synthetic corpora of growing size and prints one
+   JSON object per run, so results from two versions can be diffed or fed to
+   a script. With --generate it only writes a corpus to standard output. */
+
+#define _GNU_SOURCE
+
+/* C */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX */
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* instructions between labels, so branches have somewhere to go */
+#define LABEL_INTERVAL 16
+
+typedef enum {
+    MIX_EXIT,     /* tests/exit.ll over and over */
+    MIX_GPR,      /* general purpose arithmetic, moves and memory operands */
+    MIX_SIMD,     /* SSE2 and AVX2 */
+    MIX_BRANCHES, /* short and long jmp, jcc and call */
+    MIX_MIXED     /* all of the above */
+} mix_t;
+
+static const char *const MIX_NAMES[] = {
+    [MIX_EXIT] = "exit",
+    [MIX_GPR] = "gpr",
+    [MIX_SIMD] = "simd",
+    [MIX_BRANCHES] = "branches",
+    [MIX_MIXED] = "mixed"
+};
+#define MIX_NAMES_SIZE (sizeof MIX_NAMES / sizeof MIX_NAMES[0])
+
+static const char *const R64[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+static const char *const R32[] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+};
+static const char *const ALU[] = {
+    "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"
+};
+static const char *const SSE[] = {
+    "paddb", "paddd", "paddq", "psubd", "pand", "por", "pxor", "pcmpeqb"
+};
+static const char *const AVX[] = {
+    "vpaddb", "vpaddd", "vpaddq", "vpsubd", "vpand", "vpor", "vpxor",
+    "vpcmpeqb"
+};
+static const char *const JCC[] = {
+    "je", "jne", "jl", "jge", "jle", "jg", "jb", "jae"
+};
+#define PICK(array) array[next_random() % (sizeof array / sizeof array[0])]
+
+static uint64_t random_state;
+
+static uint64_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+/* immediates of every encoded size: 8, 32 and 64 bits */
+static int64_t random_immediate(void)
+{
+    switch (next_random() % 4) {
+    case 0:
+        return (int64_t) (next_random() % 256) - 128;
+    case 1:
+        return next_random() % 100000;
+    case 2:
+        return -(int64_t) (next_random() % 100000);
+    default:
+        return next_random() >> 1;
+    }
+}
+
+/* [base], [base + disp8] or [base + disp32] */
+static int format_memory(char *line, size_t size)
+{
+    const char *base = PICK(R64);
+    switch (next_random() % 3) {
+    case 0:
+        return snprintf(line, size, "[%s]", base);
+    case 1:
+        return snprintf(line, size, "[%s + %d]", base,
+                        (int) (next_random() % 128));
+    default:
+        return snprintf(line, size, "[%s - %d]", base,
+                        (int) (next_random() % 100000));
+    }
+}
+
+static void gpr_line(char *line, size_t size)
+{
+    char memory[32];
+    switch (next_random() % 6) {
+    case 0:
+        snprintf(line, size, "mov %s, %" PRId64 "\n", PICK(R64),
+                 random_immediate());
+        break;
+    case 1:
+        snprintf(line, size, "%s %s, %s\n", PICK(ALU), PICK(R64), PICK(R64));
+        break;
+    case 2:
+        snprintf(line, size, "%s %s, %d\n", PICK(ALU), PICK(R32),
+                 (int) (next_random() % 1000));
+        break;
+    case 3:
+        format_memory(memory, sizeof(memory));
+        snprintf(line, size, "mov %s, %s\n", PICK(R64), memory);
+        break;
+    case 4:
+        format_memory(memory, sizeof(memory));
+        snprintf(line, size, "lea %s, %s\n", PICK(R64), memory);
+        break;
+    default:
+        snprintf(line, size, "imul %s, %s, %d\n", PICK(R64), PICK(R64),
+                 (int) (next_random() % 256) - 128);
+        break;
+    }
+}
+
+static void simd_line(char *line, size_t size)
+{
+    char memory[32];
+    unsigned a = next_random() % 16;
+    unsigned b = next_random() % 16;
+    unsigned c = next_random() % 16;
+    switch (next_random() % 4) {
+    case 0:
+        snprintf(line, size, "%s xmm%u, xmm%u\n", PICK(SSE), a, b);
+        break;
+    case 1:
+        snprintf(line, size, "%s ymm%u, ymm%u, ymm%u\n", PICK(AVX), a, b, c);
+        break;
+    case 2:
+        format_memory(memory, sizeof(memory));
+        snprintf(line, size, "vmovdqu ymm%u, %s\n", a, memory);
+        break;
+    default:
+        format_memory(memory, sizeof(memory));
+        snprintf(line, size, "movdqu %s, xmm%u\n", memory, a);
+        break;
+    }
+}
+
+/* targets are near (short forms) most of the time and anywhere already
+   defined otherwise, forward ones are defined later by the caller */
+static uint64_t branch_line(char *line, size_t size, uint64_t label)
+{
+    uint64_t target = label + next_random() % 4;
+    if (next_random() % 8 == 0) {
+        target = next_random() % (label + 1);
+    }
+    switch (next_random() % 3) {
+    case 0:
+        snprintf(line, size, "jmp l%" PRIu64 "\n", target);
+        break;
+    case 1:
+        snprintf(line, size, "%s l%" PRIu64 "\n", PICK(JCC), target);
+        break;
+    default:
+        snprintf(line, size, "call l%" PRIu64 "\n", target);
+        break;
+    }
+    return target;
+}
+
+/* writes at least size bytes of the mix (a whole program, every label it
+   uses is defined) to output, returns the number of instructions or -1 */
+static int64_t generate(FILE *output, mix_t mix, uint64_t size,
+                        uint64_t seed)
+{
+    static const char *const EXIT_PROGRAM[] = {
+        "mov rax, 60\n", "mov rdi, 0\n", "syscall\n"
+    };
+    random_state = seed | 1;
+    uint64_t written = 0;
+    int64_t instructions = 0;
+    uint64_t label = 0;
+    uint64_t last_target = 0;
+    char line[128];
+    while (written < size) {
+        if (mix != MIX_EXIT
+            && (uint64_t) instructions == label * LABEL_INTERVAL) {
+            snprintf(line, sizeof(line), "l%" PRIu64 ":\n", label++);
+        }
+        else {
+            mix_t line_mix = mix;
+            if (mix == MIX_MIXED) {
+                line_mix = MIX_GPR + next_random() % 3;
+            }
+            switch (line_mix) {
+            case MIX_EXIT:
+                snprintf(line, sizeof(line), "%s",
+                         EXIT_PROGRAM[instructions % 3]);
+                break;
+            case MIX_SIMD:
+                simd_line(line, sizeof(line));
+                break;
+            case MIX_BRANCHES:
+                {
+                    uint64_t target = branch_line(line, sizeof(line), label);
+                    if (target > last_target) {
+                        last_target = target;
+                    }
+                }
+                break;
+            case MIX_GPR:
+            default:
+                gpr_line(line, sizeof(line));
+                break;
+            }
+            ++instructions;
+        }
+        if (fputs(line, output) == EOF) {
+            return -1;
+        }
+        written += strlen(line);
+    }
+    /* the exit program is never cut short */
+    while (mix == MIX_EXIT && instructions % 3 != 0) {
+        if (fputs(EXIT_PROGRAM[instructions % 3], output) == EOF) {
+            return -1;
+        }
+        ++instructions;
+    }
+    while (label <= last_target) {
+        if (fprintf(output, "l%" PRIu64 ":\n", label++) < 0) {
+            return -1;
+        }
+    }
+    return instructions;
+}
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+typedef struct {
+    double seconds;
+    long peak_rss_kib;
+} run_t;
+
+/* runs the assembler on input once, returns false if it could not be run
+   or failed */
+static bool run_assembler(const char *assembler, const char *threads,
+                          const char *input, const char *output, run_t *run)
+{
+    double start = now();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        execl(assembler, assembler, "-j", threads, input, "-o", output,
+              (char *) NULL);
+        perror(assembler);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == -1) {
+        perror("wait4");
+        return false;
+    }
+    run->seconds = now() - start;
+    run->peak_rss_kib = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed on %s\n", assembler, input);
+        return false;
+    }
+    return true;
+}
+
+/* parses a size with an optional K, M or G suffix */
+static bool parse_size(const char *string, uint64_t *size)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(string, &end, 10);
+    if (errno != 0 || end == string) {
+        return false;
+    }
+    switch (*end) {
+    case 'G':
+        value <<= 10;
+        /* fall through */
+    case 'M':
+        value <<= 10;
+        /* fall through */
+    case 'K':
+        value <<= 10;
+        ++end;
+        break;
+    default:
+        break;
+    }
+    *size = value;
+    return *end == '\0';
+}
+
+static bool parse_mix(const char *string, mix_t *mix)
+{
+    for (size_t i = 0; i < MIX_NAMES_SIZE; ++i) {
+        if (strcmp(string, MIX_NAMES[i]) == 0) {
+            *mix = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [--assembler path] [-j threads] [--max-size size]"
+            " [--repeat n] [--mix name]\n"
+            "       %s --generate mix --size size [--seed n]\n"
+            "sizes take a K, M or G suffix, mixes are exit, gpr, simd,"
+            " branches and mixed\n",
+            program, program);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option OPTIONS[] = {
+        { "assembler", required_argument, NULL, 'a' },
+        { "generate", required_argument, NULL, 'g' },
+        { "max-size", required_argument, NULL, 'm' },
+        { "mix", required_argument, NULL, 'x' },
+        { "repeat", required_argument, NULL, 'r' },
+        { "seed", required_argument, NULL, 'e' },
+        { "size", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *assembler = "build/bin/assembler";
+    unsigned long threads = 1;
+    uint64_t max_size = 64 << 20;
+    uint64_t size = 0;
+    uint64_t seed = 1;
+    unsigned long repeat = 3;
+    bool is_generating = false;
+    bool is_one_mix = false;
+    mix_t mix = MIX_MIXED;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:", OPTIONS, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+            assembler = optarg;
+            break;
+        case 'g':
+            is_generating = true;
+            /* fall through */
+        case 'x':
+            if (!parse_mix(optarg, &mix)) {
+                fprintf(stderr, "unknown mix '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            is_one_mix = true;
+            break;
+        case 'j':
+            threads = strtoul(optarg, NULL, 10);
+            if (threads == 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'm':
+            if (!parse_size(optarg, &max_size)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            repeat = strtoul(optarg, NULL, 10);
+            if (repeat == 0) {
+                repeat = 1;
+            }
+            break;
+        case 'e':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            if (!parse_size(optarg, &size)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || (is_generating && size == 0)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (is_generating) {
+        return generate(stdout, mix, size, seed) == -1 ? EXIT_FAILURE
+                                                       : EXIT_SUCCESS;
+    }
+
+    char threads_argument[32];
+    snprintf(threads_argument, sizeof(threads_argument), "%lu", threads);
+    const char *directory = getenv("TMPDIR");
+    if (directory == NULL) {
+        directory = "/tmp";
+    }
+    char input_path[256];
+    char output_path[256];
+    snprintf(input_path, sizeof(input_path), "%s/eyl-bench-XXXXXX.ll",
+             directory);
+    snprintf(output_path, sizeof(output_path), "%s/eyl-bench-XXXXXX",
+             directory);
+    int input_fd = mkstemps(input_path, 3);
+    if (input_fd == -1) {
+        perror(input_path);
+        return EXIT_FAILURE;
+    }
+    int output_fd = mkstemp(output_path);
+    if (output_fd == -1) {
+        perror(output_path);
+        unlink(input_path);
+        return EXIT_FAILURE;
+    }
+    close(output_fd);
+
+    int status = EXIT_SUCCESS;
+    for (size_t m = 0; m < MIX_NAMES_SIZE && status == EXIT_SUCCESS; ++m) {
+        if (is_one_mix && m != mix) {
+            continue;
+        }
+        /* 1 KiB, 16 KiB, 256 KiB, 4 MiB, 64 MiB and 1 GiB */
+        for (uint64_t s = 1 << 10; s <= max_size; s <<= 4) {
+            FILE *input = fopen(input_path, "w");
+            if (input == NULL) {
+                perror(input_path);
+                status = EXIT_FAILURE;
+                break;
+            }
+            int64_t instructions = generate(input, m, s, seed);
+            long input_size = ftell(input);
+            if (fclose(input) != 0 || instructions == -1) {
+                perror(input_path);
+                status = EXIT_FAILURE;
+                break;
+            }
+
+            /* the fastest run is the least disturbed by everything else */
+            run_t best = { 0, 0 };
+            for (unsigned long r = 0; r < repeat; ++r) {
+                run_t run;
+                if (!run_assembler(assembler, threads_argument, input_path,
+                                   output_path, &run)) {
+                    status = EXIT_FAILURE;
+                    break;
+                }
+                if (r == 0 || run.seconds < best.seconds) {
+                    best.seconds = run.seconds;
+                }
+                if (run.peak_rss_kib > best.peak_rss_kib) {
+                    best.peak_rss_kib = run.peak_rss_kib;
+                }
+            }
+            if (status != EXIT_SUCCESS) {
+                break;
+            }
+            printf("{\"mix\": \"%s\", \"threads\": %lu, "
+                   "\"input_bytes\": %ld, \"instructions\": %" PRId64 ", "
+                   "\"seconds\": %.6f, \"mb_per_s\": %.3f, "
+                   "\"instructions_per_s\": %.0f, "
+                   "\"peak_rss_kib\": %ld}\n",
+                   MIX_NAMES[m], threads, input_size, instructions,
+                   best.seconds, input_size / best.seconds / 1e6,
+                   instructions / best.seconds, best.peak_rss_kib);
+            fflush(stdout);
+        }
+    }
+
+    unlink(input_path);
+    unlink(output_path);
+    return status;
+}
@@ -0,0 +1,143 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/* Compares name lookup through perfect_hash_t against the linear strlen +
+   strncmp scan the assembler used to do, for growing table sizes. */
+
+#define _POSIX_C_SOURCE 200809L
+
+/* C */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "perfect_hash.h"
+
+#define NAME_CAPACITY 16
+#define TOKENS_SIZE (1 << 22)
+#define LINEAR_WORK (1 << 26)
+
+static uint64_t random_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* a random 1-6 letter prefix followed by the index as 3 base 26 digits, so
+   every name is unique and the lengths vary like real mnemonics */
+static void make_name(char *name, size_t index)
+{
+    size_t prefix_size = 1 + next_random() % 6;
+    size_t size = 0;
+    for (; size < prefix_size; ++size) {
+        name[size] = 'a' + next_random() % 26;
+    }
+    for (size_t digit = 0; digit < 3; ++digit) {
+        name[size++] = 'a' + index % 26;
+        index /= 26;
+    }
+    name[size] = '\0';
+}
+
+static int32_t linear_find(char (*names)[NAME_CAPACITY], size_t names_size,
+                           const char *start, size_t size)
+{
+    for (size_t i = 0; i < names_size; ++i) {
+        if (size == strlen(names[i]) && strncmp(names[i], start, size) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int main(void)
+{
+    static const size_t SIZES[] = { 2, 8, 32, 128, 512, 2048, 8192 };
+    size_t *tokens = malloc(TOKENS_SIZE * sizeof(*tokens));
+    if (tokens == NULL) {
+        perror("malloc tokens");
+        return EXIT_FAILURE;
+    }
+
+    printf("%8s %16s %16s\n", "entries", "hashed tokens/s", "linear tokens/s");
+    for (size_t s = 0; s < sizeof SIZES / sizeof SIZES[0]; ++s) {
+        size_t names_size = SIZES[s];
+        char (*names)[NAME_CAPACITY] = malloc(names_size * NAME_CAPACITY);
+        if (names == NULL) {
+            perror("malloc names");
+            return EXIT_FAILURE;
+        }
+
+        perfect_hash_t table;
+        perfect_hash_init(&table);
+        for (size_t i = 0; i < names_size; ++i) {
+            make_name(names[i], i);
+            perfect_hash_add(&table, names[i], i);
+        }
+        if (!perfect_hash_build(&table)) {
+            fprintf(stderr, "building table of %zu entries failed\n",
+                    names_size);
+            return EXIT_FAILURE;
+        }
+        for (size_t i = 0; i < TOKENS_SIZE; ++i) {
+            tokens[i] = next_random() % names_size;
+        }
+
+        int64_t checksum = 0;
+        double start = now();
+        for (size_t i = 0; i < TOKENS_SIZE; ++i) {
+            const char *name = names[tokens[i]];
+            checksum += perfect_hash_find(&table, name, strlen(name));
+        }
+        double hashed = TOKENS_SIZE / (now() - start);
+
+        size_t linear_tokens = LINEAR_WORK / names_size;
+        if (linear_tokens > TOKENS_SIZE) {
+            linear_tokens = TOKENS_SIZE;
+        }
+        start = now();
+        for (size_t i = 0; i < linear_tokens; ++i) {
+            const char *name = names[tokens[i]];
+            checksum -= linear_find(names, names_size, name, strlen(name));
+        }
+        double linear = linear_tokens / (now() - start);
+
+        printf("%8zu %16.0f %16.0f\n", names_size, hashed, linear);
+        if (checksum != 0 && linear_tokens == TOKENS_SIZE) {
+            fprintf(stderr, "lookup mismatch\n");
+            return EXIT_FAILURE;
+        }
+
+        perfect_hash_fini(&table);
+        free(names);
+    }
+
+    free(tokens);
+    return EXIT_SUCCESS;
+}
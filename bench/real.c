@@ -0,0 +1,185 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/* Compares parsing real literals with real_parse_binary64 and
+   real_parse_binary32 against strtod and strtof, on a few kinds of
+   literals, and checks that every value is the same. */
+
+#define _POSIX_C_SOURCE 200809L
+
+/* C */
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "real.h"
+
+#define LITERALS_SIZE (1 << 20)
+#define LITERAL_CAPACITY 32
+
+static uint64_t random_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* any finite double with all 17 digits, like the tables of n-body.pel */
+static void make_exact(char *literal)
+{
+    double value;
+    do {
+        uint64_t bits = next_random();
+        memcpy(&value, &bits, sizeof(value));
+    } while (!isfinite(value));
+    snprintf(literal, LITERAL_CAPACITY, "%.17e", value);
+}
+
+/* a number of about unit size with a few decimals, like 0.01 or -3.25 */
+static void make_short(char *literal)
+{
+    snprintf(literal, LITERAL_CAPACITY, "%s%d.%0*d",
+             next_random() % 2 ? "-" : "", (int) (next_random() % 1000),
+             (int) (1 + next_random() % 4), (int) (next_random() % 10000));
+}
+
+/* an integer part, a fraction and an exponent of any size */
+static void make_scientific(char *literal)
+{
+    snprintf(literal, LITERAL_CAPACITY, "%d.%06de%d",
+             (int) (1 + next_random() % 9), (int) (next_random() % 1000000),
+             (int) (next_random() % 600) - 300);
+}
+
+static uint64_t bits_64(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static uint64_t bits_32(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+typedef struct {
+    const char *name;
+    void (*make)(char *literal);
+} corpus_t;
+
+int main(void)
+{
+    static const corpus_t CORPORA[] = {
+        { "exact", make_exact },
+        { "short", make_short },
+        { "scientific", make_scientific }
+    };
+    char (*literals)[LITERAL_CAPACITY] =
+        malloc(LITERALS_SIZE * LITERAL_CAPACITY);
+    size_t *sizes = malloc(LITERALS_SIZE * sizeof(*sizes));
+    if (literals == NULL || sizes == NULL) {
+        perror("malloc literals");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-12s %14s %14s %14s %14s\n", "literals", "binary64/s",
+           "strtod/s", "binary32/s", "strtof/s");
+    for (size_t c = 0; c < sizeof CORPORA / sizeof CORPORA[0]; ++c) {
+        for (size_t i = 0; i < LITERALS_SIZE; ++i) {
+            CORPORA[c].make(literals[i]);
+            sizes[i] = strlen(literals[i]);
+        }
+
+        /* the bit patterns are folded in so the values are used */
+        uint64_t checksum = 0;
+        double start = now();
+        for (size_t i = 0; i < LITERALS_SIZE; ++i) {
+            double value;
+            const char *end;
+            real_parse_binary64(literals[i], literals[i] + sizes[i], &value,
+                                &end);
+            checksum ^= bits_64(value);
+        }
+        double binary64 = LITERALS_SIZE / (now() - start);
+
+        start = now();
+        for (size_t i = 0; i < LITERALS_SIZE; ++i) {
+            checksum ^= bits_64(strtod(literals[i], NULL));
+        }
+        double strtod_rate = LITERALS_SIZE / (now() - start);
+
+        start = now();
+        for (size_t i = 0; i < LITERALS_SIZE; ++i) {
+            float value;
+            const char *end;
+            real_parse_binary32(literals[i], literals[i] + sizes[i], &value,
+                                &end);
+            checksum ^= bits_32(value);
+        }
+        double binary32 = LITERALS_SIZE / (now() - start);
+
+        start = now();
+        for (size_t i = 0; i < LITERALS_SIZE; ++i) {
+            checksum ^= bits_32(strtof(literals[i], NULL));
+        }
+        double strtof_rate = LITERALS_SIZE / (now() - start);
+
+        printf("%-12s %14.0f %14.0f %14.0f %14.0f\n", CORPORA[c].name,
+               binary64, strtod_rate, binary32, strtof_rate);
+
+        /* every value is checked on its own, outside the timing */
+        for (size_t i = 0; i < LITERALS_SIZE; ++i) {
+            const char *literal_end = literals[i] + sizes[i];
+            double value;
+            float value_32;
+            const char *end;
+            const char *end_32;
+            real_parse_binary64(literals[i], literal_end, &value, &end);
+            real_parse_binary32(literals[i], literal_end, &value_32,
+                                &end_32);
+            if (bits_64(value) != bits_64(strtod(literals[i], NULL))
+                || bits_32(value_32) != bits_32(strtof(literals[i], NULL))
+                || end != literal_end || end_32 != literal_end) {
+                fprintf(stderr, "%s parsed differently\n", literals[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        if (checksum != 0) {
+            fprintf(stderr, "%s checksum mismatch\n", CORPORA[c].name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    free(sizes);
+    free(literals);
+    return EXIT_SUCCESS;
+}
@@ -1,93 +1,373 @@
-#include <cstddef>
-#include <cstdint>
+#include "arithmetic.h"
 
-enum class token {
-    UNKNOWN,
-    INTEGER_LITERAL,
-    BINARY_OPERATION,
-};
+#include <cstring>
 
-enum class binary_operation {
-    ADDITION,
-    SUBTRACTION,
-    MULTIPLICATION,
-    DIVISION
-};
+#include "literal.h"
 
-class integer_literal {
-private:
-    int64_t value;
-};
+// There are never more tokens than bytes, so the stream is grown once up
+// front instead of checking as it goes.
+bool lex(const char* input, size_t size, token_stream& tokens) {
+    tokens.clear();
+    tokens.reserve(size);
+    size_t i = 0;
+    while (i < size) {
+        char c = input[i];
+        if (c >= '0' && c <= '9') {
+            // a literal that does not fit is an error too
+            uint64_t value;
+            const char* end;
+            if (literal_parse(input + i, input + size, &value, &end)
+                    != LITERAL_OK
+                || value > INT64_MAX) {
+                tokens.error_offset = i;
+                return false;
+            }
+            tokens.push(token::INTEGER_LITERAL, i, end - (input + i),
+                        static_cast<int64_t>(value));
+            i = end - input;
+            continue;
+        }
 
-int64_t integer_value(const char* start, size_t size) {
-    int64_t v = 0;
-    int64_t e = 1;
-    size_t i = size - 1;
-    while (true) {
-        v += (start[i] - '0') * e;
-        e *= 10;
-        if (i == 0) break;
-        --i;
-    }
-    return v;
+        binary_operation operation;
+        if (c == '+') {
+            operation = binary_operation::ADDITION;
+        }
+        else if (c == '-') {
+            operation = binary_operation::SUBTRACTION;
+        }
+        else if (c == '*') {
+            operation = binary_operation::MULTIPLICATION;
+        }
+        else if (c == '/') {
+            operation = binary_operation::DIVISION;
+        }
+        else if (c == '(' || c == ')') {
+            tokens.push(c == '(' ? token::OPEN_PARENTHESIS
+                                 : token::CLOSE_PARENTHESIS, i, 1, 0);
+            ++i;
+            continue;
+        }
+        else if (c == ' ') {
+            // ignore spaces
+            ++i;
+            continue;
+        }
+        else {
+            tokens.error_offset = i;
+            return false;
+        }
+        tokens.push(token::BINARY_OPERATION, i, 1,
+                    static_cast<int64_t>(operation));
+        ++i;
+    }
+    return true;
 }
 
-bool lex(const char* input) {
-    token t = token::UNKNOWN;
+bool lex(const char* input, token_stream& tokens) {
+    return lex(input, std::strlen(input), tokens);
+}
 
-    char c = *input;
-    const char* start;
-    size_t size;
-    while (c != '\0') {
-        bool should_advance = true;
+evaluation_result apply(binary_operation operation, int64_t left,
+                        int64_t right, int64_t* result) {
+    switch (operation) {
+    case binary_operation::ADDITION:
+        if (__builtin_add_overflow(left, right, result)) {
+            return evaluation_result::INTEGER_OVERFLOW;
+        }
+        return evaluation_result::OK;
+    case binary_operation::SUBTRACTION:
+        if (__builtin_sub_overflow(left, right, result)) {
+            return evaluation_result::INTEGER_OVERFLOW;
+        }
+        return evaluation_result::OK;
+    case binary_operation::MULTIPLICATION:
+        if (__builtin_mul_overflow(left, right, result)) {
+            return evaluation_result::INTEGER_OVERFLOW;
+        }
+        return evaluation_result::OK;
+    case binary_operation::DIVISION:
+        if (right == 0) {
+            return evaluation_result::DIVISION_BY_ZERO;
+        }
+        if (left == INT64_MIN && right == -1) {
+            return evaluation_result::INTEGER_OVERFLOW;
+        }
+        *result = left / right;
+        return evaluation_result::OK;
+    }
+    return evaluation_result::OK;
+}
 
-        if (t == token::UNKNOWN) {
-            if (c >= '0' && c <= '9') {
-                t = token::INTEGER_LITERAL;
-                start = input;
-                size = 1;
-            }
-            else if (c == '+') {
-                printf("addition\n");
-            }
-            else if (c == '-') {
-                printf("subtraction\n");
-            }
-            else if (c == '*') {
-                printf("multiplication\n");
-            }
-            else if (c == '/') {
-                printf("divison\n");
-            }
-            else if (c == ' ') {
-                // ignore spaces
+evaluation_result negate(int64_t operand, int64_t* result) {
+    if (__builtin_sub_overflow(int64_t(0), operand, result)) {
+        return evaluation_result::INTEGER_OVERFLOW;
+    }
+    return evaluation_result::OK;
+}
+
+// A Pratt parser, each binary operation binds as tightly as its
+// precedence and equal ones group to the left. A minus in front of an
+// operand negates it and binds tighter than any binary operation, so
+// -2 * 3 is (-2) * 3. Every node that only has integer literals below it
+// is folded into one integer literal as soon as it is parsed, unless that
+// would be undefined, so 1 / 0 stays a division for evaluation to report.
+class parser {
+public:
+    parser(const token_stream& tokens, syntax_tree& tree, bool is_folding)
+        : tokens(tokens), tree(tree), is_folding(is_folding) {}
+
+    bool parse() {
+        if (!parse_expression(0, &tree.root) || next != tokens.size()) {
+            tree.error_offset = offset();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr unsigned NEGATION_PRECEDENCE = 3;
+
+    const token_stream& tokens;
+    syntax_tree& tree;
+    bool is_folding;
+    size_t next = 0;
+    size_t depth = 0;
+
+    static unsigned precedence(binary_operation operation) {
+        switch (operation) {
+        case binary_operation::ADDITION:
+        case binary_operation::SUBTRACTION:
+            return 1;
+        case binary_operation::MULTIPLICATION:
+        case binary_operation::DIVISION:
+            return 2;
+        }
+        return 0;
+    }
+
+    // of the next token, or the end of the last one
+    size_t offset() const {
+        if (next < tokens.size()) {
+            return tokens.offsets[next];
+        }
+        if (tokens.size() == 0) {
+            return 0;
+        }
+        return tokens.offsets[tokens.size() - 1]
+            + tokens.lengths[tokens.size() - 1];
+    }
+
+    bool is_literal(uint32_t index) const {
+        return tree.nodes[index].kind == node_kind::INTEGER_LITERAL;
+    }
+
+    // A folded subtree is a single node and the last one, so an operation
+    // on folded operands folds by replacing them with its result.
+    uint32_t push_negation(uint32_t operand) {
+        int64_t value;
+        if (is_folding && is_literal(operand)
+            && negate(tree.nodes[operand].value, &value)
+                == evaluation_result::OK) {
+            tree.nodes[operand].value = value;
+            return operand;
+        }
+        uint32_t index = tree.push(node_kind::NEGATION,
+                                   binary_operation::SUBTRACTION);
+        tree.nodes[index].children[0] = operand;
+        return index;
+    }
+
+    uint32_t push_binary(binary_operation operation, uint32_t left,
+                         uint32_t right) {
+        int64_t value;
+        if (is_folding && is_literal(left) && is_literal(right)
+            && apply(operation, tree.nodes[left].value,
+                     tree.nodes[right].value, &value)
+                == evaluation_result::OK) {
+            tree.nodes[left].value = value;
+            tree.truncate(left);
+            return left;
+        }
+        uint32_t index = tree.push(node_kind::BINARY_OPERATION, operation);
+        tree.nodes[index].children[0] = left;
+        tree.nodes[index].children[1] = right;
+        return index;
+    }
+
+    bool parse_operand(uint32_t* index) {
+        if (next == tokens.size()) {
+            return false;
+        }
+        token kind = tokens.kinds[next];
+        if (kind == token::INTEGER_LITERAL) {
+            *index = tree.push(node_kind::INTEGER_LITERAL,
+                               binary_operation::ADDITION);
+            tree.nodes[*index].value = tokens.values[next];
+            ++next;
+            return true;
+        }
+        if (depth == NESTING_LIMIT) {
+            return false;
+        }
+        if (kind == token::BINARY_OPERATION
+            && tokens.values[next]
+                == static_cast<int64_t>(binary_operation::SUBTRACTION)) {
+            ++next;
+            ++depth;
+            uint32_t operand;
+            if (!parse_expression(NEGATION_PRECEDENCE, &operand)) {
+                return false;
             }
-            else {
+            --depth;
+            *index = push_negation(operand);
+            return true;
+        }
+        if (kind == token::OPEN_PARENTHESIS) {
+            ++next;
+            ++depth;
+            if (!parse_expression(0, index) || next == tokens.size()
+                || tokens.kinds[next] != token::CLOSE_PARENTHESIS) {
                 return false;
             }
+            ++next;
+            --depth;
+            return true;
         }
-        else if (t == token::INTEGER_LITERAL) {
-            if (c >= '0' && c <= '9') {
-                ++size;
+        return false;
+    }
+
+    // parses operations that bind at least as tightly as minimum
+    bool parse_expression(unsigned minimum, uint32_t* index) {
+        uint32_t left;
+        if (!parse_operand(&left)) {
+            return false;
+        }
+        while (next < tokens.size()
+               && tokens.kinds[next] == token::BINARY_OPERATION) {
+            auto operation =
+                static_cast<binary_operation>(tokens.values[next]);
+            unsigned operation_precedence = precedence(operation);
+            if (operation_precedence < minimum) {
+                break;
             }
-            else {
-                printf("integer literal with value: %ld\n",
-                       integer_value(start, size));
-                t = token::UNKNOWN;
-                should_advance = false;
+            ++next;
+            uint32_t right;
+            if (!parse_expression(operation_precedence + 1, &right)) {
+                return false;
             }
+            left = push_binary(operation, left, right);
         }
+        *index = left;
+        return true;
+    }
+};
+
+// A tree never has more nodes than there are tokens, so it is grown once
+// up front.
+bool parse(const token_stream& tokens, syntax_tree& tree, bool is_folding) {
+    tree.clear();
+    tree.reserve(tokens.size());
+    return parser(tokens, tree, is_folding).parse();
+}
 
-        if (should_advance) {
-            ++input;
-            c = *input;
+// The nodes of a tree are in the order the tree walk finishes them, every
+// child before its parent and the left one before the right one, so
+// compiling them in that order evaluates the operations in the same order
+// and stops at the same undefined one. Every value goes into the next free
+// register and an operation replaces its operands with its result, so no
+// more registers are used than operands wait at once.
+void compile(const syntax_tree& tree, bytecode& program) {
+    static const opcode OPCODES[] = {
+        opcode::ADD, opcode::SUBTRACT, opcode::MULTIPLY, opcode::DIVIDE
+    };
+    size_t size = tree.size();
+    program.clear();
+    program.reserve(size + 1);
+    // the registers in use
+    uint16_t used = 0;
+    for (size_t i = 0; i < size; ++i) {
+        const node& n = tree.nodes[i];
+        if (n.kind == node_kind::INTEGER_LITERAL) {
+            program.push(opcode::LOAD, used, 0, 0);
+            program.push_constant(n.value);
+            ++used;
+        }
+        else if (n.kind == node_kind::NEGATION) {
+            program.push(opcode::NEGATE, used - 1, used - 1, 0);
+        }
+        else {
+            program.push(OPCODES[static_cast<size_t>(n.operation)],
+                         used - 2, used - 2, used - 1);
+            --used;
         }
     }
+    program.push(opcode::RETURN, 0, 0, 0);
+}
+
+// Threaded dispatch with computed gotos: every handler ends with its own
+// indirect jump to the next one, which branch predictors learn far better
+// than the single jump of a switch in a loop.
+evaluation_result evaluate(const bytecode& program, int64_t* value) {
+    static const void* const HANDLERS[] = {
+        &&load, &&negate, &&add, &&subtract, &&multiply, &&divide,
+        &&return_value
+    };
+    int64_t registers[REGISTERS_CAPACITY];
+    const instruction* next = program.instructions.data();
+    const int64_t* constant = program.constants.data();
+    instruction current;
+
+#define DISPATCH() \
+    do { \
+        current = *next++; \
+        goto *HANDLERS[static_cast<size_t>(current.operation)]; \
+    } while (0)
 
-    if (t == token::INTEGER_LITERAL) {
-        printf("integer literal with value: %ld\n",
-               integer_value(start, size));
+    DISPATCH();
+load:
+    registers[current.destination] = *constant++;
+    DISPATCH();
+negate:
+    if (__builtin_sub_overflow(int64_t(0), registers[current.left],
+                               &registers[current.destination])) {
+        return evaluation_result::INTEGER_OVERFLOW;
+    }
+    DISPATCH();
+add:
+    if (__builtin_add_overflow(registers[current.left],
+                               registers[current.right],
+                               &registers[current.destination])) {
+        return evaluation_result::INTEGER_OVERFLOW;
+    }
+    DISPATCH();
+subtract:
+    if (__builtin_sub_overflow(registers[current.left],
+                               registers[current.right],
+                               &registers[current.destination])) {
+        return evaluation_result::INTEGER_OVERFLOW;
     }
+    DISPATCH();
+multiply:
+    if (__builtin_mul_overflow(registers[current.left],
+                               registers[current.right],
+                               &registers[current.destination])) {
+        return evaluation_result::INTEGER_OVERFLOW;
+    }
+    DISPATCH();
+divide:
+    if (registers[current.right] == 0) {
+        return evaluation_result::DIVISION_BY_ZERO;
+    }
+    if (registers[current.left] == INT64_MIN
+        && registers[current.right] == -1) {
+        return evaluation_result::INTEGER_OVERFLOW;
+    }
+    registers[current.destination] =
+        registers[current.left] / registers[current.right];
+    DISPATCH();
+return_value:
+    *value = registers[current.left];
+    return evaluation_result::OK;
 
-    return true;
+#undef DISPATCH
 }
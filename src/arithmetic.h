@@ -0,0 +1,251 @@
+/*
+ * Copyright 2015 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EYL_ARITHMETIC_H
+#define EYL_ARITHMETIC_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+enum class token : uint8_t {
+    UNKNOWN,
+    INTEGER_LITERAL,
+    BINARY_OPERATION,
+    OPEN_PARENTHESIS,
+    CLOSE_PARENTHESIS,
+};
+
+enum class binary_operation : uint8_t {
+    ADDITION,
+    SUBTRACTION,
+    MULTIPLICATION,
+    DIVISION
+};
+
+// The tokens of an expression in struct-of-arrays form, token i < size()
+// is kinds[i] at offsets[i] for lengths[i] bytes with the decoded
+// values[i]: the value of an integer literal or the binary_operation of an
+// operator. The arrays only ever grow, lexing into the same stream again
+// reuses them, so after the first few expressions lexing does not allocate.
+class token_stream {
+public:
+    std::vector<token> kinds;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<int64_t> values;
+    // where lexing stopped at an unknown character
+    size_t error_offset = 0;
+
+    size_t size() const { return count; }
+
+    void clear() {
+        count = 0;
+        error_offset = 0;
+    }
+
+    // makes room for capacity tokens in total
+    void reserve(size_t capacity) {
+        if (kinds.size() < capacity) {
+            kinds.resize(capacity);
+            offsets.resize(capacity);
+            lengths.resize(capacity);
+            values.resize(capacity);
+        }
+    }
+
+    // there must be room for it
+    void push(token kind, size_t offset, size_t length, int64_t value) {
+        kinds[count] = kind;
+        offsets[count] = offset;
+        lengths[count] = length;
+        values[count] = value;
+        ++count;
+    }
+
+private:
+    size_t count = 0;
+};
+
+// Replaces the tokens with the tokens of the size bytes at input, which
+// must be under 4 GiB, and returns false at the first unknown character or
+// integer literal that does not fit in an int64_t.
+bool lex(const char* input, size_t size, token_stream& tokens);
+bool lex(const char* input, token_stream& tokens);
+
+enum class node_kind : uint8_t {
+    INTEGER_LITERAL,
+    NEGATION,
+    BINARY_OPERATION,
+};
+
+// 16 bytes, the children of a node are indices into the same tree instead
+// of pointers, so a tree is one array that is cheap to reuse and to walk.
+struct node {
+    node_kind kind;
+    binary_operation operation;
+    union {
+        int64_t value;
+        // only the first is used by a negation
+        uint32_t children[2];
+    };
+};
+
+// The nodes of an expression, allocated by bumping count in an array that
+// only ever grows, like the tokens of a token_stream. Clearing frees every
+// node at once, so parsing expression after expression into the same tree
+// stops allocating after the first few. Children always come before their
+// parent and root is the last node.
+class syntax_tree {
+public:
+    std::vector<node> nodes;
+    uint32_t root = 0;
+    // of the token where parsing stopped
+    size_t error_offset = 0;
+
+    size_t size() const { return count; }
+
+    void clear() {
+        count = 0;
+        root = 0;
+        error_offset = 0;
+    }
+
+    // makes room for capacity nodes in total
+    void reserve(size_t capacity) {
+        if (nodes.size() < capacity) {
+            nodes.resize(capacity);
+        }
+    }
+
+    // there must be room for it
+    uint32_t push(node_kind kind, binary_operation operation) {
+        nodes[count].kind = kind;
+        nodes[count].operation = operation;
+        return count++;
+    }
+
+    // removes every node after index
+    void truncate(uint32_t index) {
+        count = index + 1;
+    }
+
+private:
+    uint32_t count = 0;
+};
+
+// parentheses and negations nested any deeper are a parse error instead of
+// running out of stack
+constexpr size_t NESTING_LIMIT = 1000;
+
+// Replaces the tree with the syntax tree of the tokens and returns false
+// if they are not an expression. Without folding every operation in the
+// tokens is a node.
+bool parse(const token_stream& tokens, syntax_tree& tree,
+           bool is_folding = true);
+
+// what evaluating an operation did, every undefined one is reported
+// instead of being left to the machine
+enum class evaluation_result : uint8_t {
+    OK,
+    DIVISION_BY_ZERO,
+    // of a result that does not fit in an int64_t
+    INTEGER_OVERFLOW,
+};
+
+// Sets result to left operation right unless that is undefined, division
+// truncates towards zero. These are the semantics everything that
+// evaluates an expression follows, from folding to the interpreter, and
+// each evaluates the left operand first, so with several undefined
+// operations they all report the first.
+evaluation_result apply(binary_operation operation, int64_t left,
+                        int64_t right, int64_t* result);
+evaluation_result negate(int64_t operand, int64_t* result);
+
+enum class opcode : uint8_t {
+    LOAD,     // destination = the next constant
+    NEGATE,   // destination = -left
+    ADD,      // destination = left + right
+    SUBTRACT, // destination = left - right
+    MULTIPLY, // destination = left * right
+    DIVIDE,   // destination = left / right
+    RETURN,   // the value of the expression is left
+};
+
+// 8 bytes, the operands are registers, constants are not in the
+// instructions but read in order as each LOAD runs.
+struct instruction {
+    opcode operation;
+    uint16_t destination;
+    uint16_t left;
+    uint16_t right;
+};
+
+// Registers are used like a stack, an operand waits in one while the
+// other is computed. Within a level of nesting at most two operands wait,
+// the left ones of an addition and a multiplication in 1 + 2 * (...), so
+// this is enough for any tree from parse.
+constexpr size_t REGISTERS_CAPACITY = 2 * NESTING_LIMIT + 3;
+
+// A register machine program that computes an expression, stored like a
+// syntax_tree in arrays that only ever grow.
+class bytecode {
+public:
+    std::vector<instruction> instructions;
+    std::vector<int64_t> constants;
+
+    size_t size() const { return instructions_size; }
+    size_t constants_size() const { return constants_count; }
+
+    void clear() {
+        instructions_size = 0;
+        constants_count = 0;
+    }
+
+    // makes room for capacity instructions and constants in total
+    void reserve(size_t capacity) {
+        if (instructions.size() < capacity) {
+            instructions.resize(capacity);
+            constants.resize(capacity);
+        }
+    }
+
+    // there must be room for them
+    void push(opcode operation, uint16_t destination, uint16_t left,
+              uint16_t right) {
+        instructions[instructions_size++] =
+            instruction{operation, destination, left, right};
+    }
+
+    void push_constant(int64_t value) {
+        constants[constants_count++] = value;
+    }
+
+private:
+    size_t instructions_size = 0;
+    size_t constants_count = 0;
+};
+
+// replaces the program with the code of the tree
+void compile(const syntax_tree& tree, bytecode& program);
+
+// Runs the program and sets value to what it returns, unless it stops at an
+// undefined operation.
+evaluation_result evaluate(const bytecode& program, int64_t* value);
+
+#endif
@@ -0,0 +1,1410 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#define _GNU_SOURCE
+
+#include "assembler.h"
+
+/* C */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "literal.h"
+#include "optimize.h"
+#include "perfect_hash.h"
+#include "scan.h"
+
+/* inputs are only split across threads in pieces of at least this size */
+#define PARALLEL_JOB_MIN_SIZE (4 << 20)
+
+/* branches are kept apart from INSTRUCTION_FORMS since their size depends on
+   the layout */
+typedef enum {
+    MNE_JMP, MNE_JCC, MNE_CALL
+} mnemonic_id_t;
+typedef struct {
+    char *name;
+    mnemonic_id_t id;
+    uint8_t condition; /* condition code for MNE_JCC */
+} mnemonic_info_t;
+
+static const mnemonic_info_t MNEMONIC_INFO[] = {
+    { "jmp", MNE_JMP, 0 },
+    { "call", MNE_CALL, 0 },
+    { "jo", MNE_JCC, 0x0 },
+    { "jno", MNE_JCC, 0x1 },
+    { "jb", MNE_JCC, 0x2 },
+    { "jc", MNE_JCC, 0x2 },
+    { "jnae", MNE_JCC, 0x2 },
+    { "jae", MNE_JCC, 0x3 },
+    { "jnb", MNE_JCC, 0x3 },
+    { "jnc", MNE_JCC, 0x3 },
+    { "je", MNE_JCC, 0x4 },
+    { "jz", MNE_JCC, 0x4 },
+    { "jne", MNE_JCC, 0x5 },
+    { "jnz", MNE_JCC, 0x5 },
+    { "jbe", MNE_JCC, 0x6 },
+    { "jna", MNE_JCC, 0x6 },
+    { "ja", MNE_JCC, 0x7 },
+    { "jnbe", MNE_JCC, 0x7 },
+    { "js", MNE_JCC, 0x8 },
+    { "jns", MNE_JCC, 0x9 },
+    { "jp", MNE_JCC, 0xa },
+    { "jpe", MNE_JCC, 0xa },
+    { "jnp", MNE_JCC, 0xb },
+    { "jpo", MNE_JCC, 0xb },
+    { "jl", MNE_JCC, 0xc },
+    { "jnge", MNE_JCC, 0xc },
+    { "jge", MNE_JCC, 0xd },
+    { "jnl", MNE_JCC, 0xd },
+    { "jle", MNE_JCC, 0xe },
+    { "jng", MNE_JCC, 0xe },
+    { "jg", MNE_JCC, 0xf },
+    { "jnle", MNE_JCC, 0xf }
+};
+#define MNEMONIC_INFO_SIZE (sizeof MNEMONIC_INFO / sizeof MNEMONIC_INFO[0])
+
+/* The mnemonic table maps a branch to its index in MNEMONIC_INFO and any
+   other mnemonic to its forms, packed as the first form and how many there
+   are with MNEMONIC_FORMS set. */
+#define MNEMONIC_FORMS 0x40000000
+#define MNEMONIC_FORMS_FIRST(value) (((value) & ~MNEMONIC_FORMS) >> 8)
+#define MNEMONIC_FORMS_SIZE(value) ((value) & 0xff)
+
+/* names that follow a '.' */
+typedef enum {
+    DIR_SECTION, DIR_DATA, DIR_SPACE, DIR_ASCII, DIR_SYMBOL, DIR_ALIGN
+} directive_id_t;
+typedef struct {
+    char *name;
+    directive_id_t id;
+    /* the section, the size of the data, the terminator, the symbol flag
+       or whether the alignment is a power of two */
+    uint8_t value;
+} directive_info_t;
+
+static const directive_info_t DIRECTIVE_INFO[] = {
+    { "text", DIR_SECTION, SECTION_TEXT },
+    { "rodata", DIR_SECTION, SECTION_RODATA },
+    { "data", DIR_SECTION, SECTION_DATA },
+    { "bss", DIR_SECTION, SECTION_BSS },
+    { "byte", DIR_DATA, 1 },
+    { "word", DIR_DATA, 2 },
+    { "long", DIR_DATA, 4 },
+    { "quad", DIR_DATA, 8 },
+    { "zero", DIR_SPACE, 0 },
+    { "space", DIR_SPACE, 0 },
+    { "ascii", DIR_ASCII, 0 },
+    { "asciz", DIR_ASCII, 1 },
+    { "globl", DIR_SYMBOL, SYMBOL_GLOBAL },
+    { "global", DIR_SYMBOL, SYMBOL_GLOBAL },
+    { "extern", DIR_SYMBOL, SYMBOL_EXTERN },
+    { "align", DIR_ALIGN, 0 },
+    { "balign", DIR_ALIGN, 0 },
+    { "p2align", DIR_ALIGN, 1 }
+};
+#define DIRECTIVE_INFO_SIZE (sizeof DIRECTIVE_INFO / sizeof DIRECTIVE_INFO[0])
+
+/* the id is the register number used in the ModRM, REX and VEX bytes */
+typedef struct {
+    char *name;
+    uint8_t id;
+    register_class_t register_class;
+} register_info_t;
+
+static const register_info_t REGISTER_INFO[] = {
+    { "rax", 0, REGISTER_R64 },
+    { "rcx", 1, REGISTER_R64 },
+    { "rdx", 2, REGISTER_R64 },
+    { "rbx", 3, REGISTER_R64 },
+    { "rsp", 4, REGISTER_R64 },
+    { "rbp", 5, REGISTER_R64 },
+    { "rsi", 6, REGISTER_R64 },
+    { "rdi", 7, REGISTER_R64 },
+    { "r8", 8, REGISTER_R64 },
+    { "r9", 9, REGISTER_R64 },
+    { "r10", 10, REGISTER_R64 },
+    { "r11", 11, REGISTER_R64 },
+    { "r12", 12, REGISTER_R64 },
+    { "r13", 13, REGISTER_R64 },
+    { "r14", 14, REGISTER_R64 },
+    { "r15", 15, REGISTER_R64 },
+    { "eax", 0, REGISTER_R32 },
+    { "ecx", 1, REGISTER_R32 },
+    { "edx", 2, REGISTER_R32 },
+    { "ebx", 3, REGISTER_R32 },
+    { "esp", 4, REGISTER_R32 },
+    { "ebp", 5, REGISTER_R32 },
+    { "esi", 6, REGISTER_R32 },
+    { "edi", 7, REGISTER_R32 },
+    { "r8d", 8, REGISTER_R32 },
+    { "r9d", 9, REGISTER_R32 },
+    { "r10d", 10, REGISTER_R32 },
+    { "r11d", 11, REGISTER_R32 },
+    { "r12d", 12, REGISTER_R32 },
+    { "r13d", 13, REGISTER_R32 },
+    { "r14d", 14, REGISTER_R32 },
+    { "r15d", 15, REGISTER_R32 },
+    { "xmm0", 0, REGISTER_XMM },
+    { "xmm1", 1, REGISTER_XMM },
+    { "xmm2", 2, REGISTER_XMM },
+    { "xmm3", 3, REGISTER_XMM },
+    { "xmm4", 4, REGISTER_XMM },
+    { "xmm5", 5, REGISTER_XMM },
+    { "xmm6", 6, REGISTER_XMM },
+    { "xmm7", 7, REGISTER_XMM },
+    { "xmm8", 8, REGISTER_XMM },
+    { "xmm9", 9, REGISTER_XMM },
+    { "xmm10", 10, REGISTER_XMM },
+    { "xmm11", 11, REGISTER_XMM },
+    { "xmm12", 12, REGISTER_XMM },
+    { "xmm13", 13, REGISTER_XMM },
+    { "xmm14", 14, REGISTER_XMM },
+    { "xmm15", 15, REGISTER_XMM },
+    { "ymm0", 0, REGISTER_YMM },
+    { "ymm1", 1, REGISTER_YMM },
+    { "ymm2", 2, REGISTER_YMM },
+    { "ymm3", 3, REGISTER_YMM },
+    { "ymm4", 4, REGISTER_YMM },
+    { "ymm5", 5, REGISTER_YMM },
+    { "ymm6", 6, REGISTER_YMM },
+    { "ymm7", 7, REGISTER_YMM },
+    { "ymm8", 8, REGISTER_YMM },
+    { "ymm9", 9, REGISTER_YMM },
+    { "ymm10", 10, REGISTER_YMM },
+    { "ymm11", 11, REGISTER_YMM },
+    { "ymm12", 12, REGISTER_YMM },
+    { "ymm13", 13, REGISTER_YMM },
+    { "ymm14", 14, REGISTER_YMM },
+    { "ymm15", 15, REGISTER_YMM }
+};
+#define REGISTER_INFO_SIZE (sizeof REGISTER_INFO / sizeof REGISTER_INFO[0])
+
+static perfect_hash_t mnemonic_table;
+/* maps names to their index in DIRECTIVE_INFO and REGISTER_INFO */
+static perfect_hash_t directive_table;
+static perfect_hash_t register_table;
+
+bool assembler_build_tables(void)
+{
+    perfect_hash_init(&mnemonic_table);
+    perfect_hash_init(&directive_table);
+    perfect_hash_init(&register_table);
+    for (size_t i = 0; i < MNEMONIC_INFO_SIZE; ++i) {
+        if (!perfect_hash_add(&mnemonic_table, MNEMONIC_INFO[i].name, i)) {
+            return false;
+        }
+    }
+    /* the forms of a mnemonic are adjacent */
+    size_t first = 0;
+    for (size_t i = 1; i <= INSTRUCTION_FORMS_SIZE; ++i) {
+        if (i < INSTRUCTION_FORMS_SIZE
+            && strcmp(INSTRUCTION_FORMS[i].mnemonic,
+                      INSTRUCTION_FORMS[first].mnemonic) == 0) {
+            continue;
+        }
+        int32_t value = MNEMONIC_FORMS | first << 8 | (i - first);
+        if (!perfect_hash_add(&mnemonic_table,
+                              INSTRUCTION_FORMS[first].mnemonic, value)) {
+            return false;
+        }
+        first = i;
+    }
+    for (size_t i = 0; i < DIRECTIVE_INFO_SIZE; ++i) {
+        if (!perfect_hash_add(&directive_table, DIRECTIVE_INFO[i].name, i)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < REGISTER_INFO_SIZE; ++i) {
+        if (!perfect_hash_add(&register_table, REGISTER_INFO[i].name, i)) {
+            return false;
+        }
+    }
+    return perfect_hash_build(&mnemonic_table)
+        && perfect_hash_build(&directive_table)
+        && perfect_hash_build(&register_table);
+}
+
+void assembler_free_tables(void)
+{
+    perfect_hash_fini(&mnemonic_table);
+    perfect_hash_fini(&directive_table);
+    perfect_hash_fini(&register_table);
+}
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/* where parsing a line is and what went wrong with it, if anything */
+typedef struct {
+    const char *current;
+    const char *line_end;
+    symbol_table_t *labels;
+    uint8_t section; /* the buffer instructions go in, JOB_INHERITED first */
+    uint64_t *alignments; /* the largest in each buffer */
+    FILE *listing;
+    uint64_t tokens;
+    const char *error; /* NULL, or a static message about error_start */
+    const char *error_start;
+    const char *error_end;
+} line_parser_t;
+
+static bool parse_error(line_parser_t *parser, const char *message,
+                        const char *start, const char *end)
+{
+    parser->error = message;
+    parser->error_start = start;
+    parser->error_end = end;
+    return false;
+}
+
+static void skip_blanks(line_parser_t *parser)
+{
+    while (parser->current != parser->line_end
+           && (*parser->current == ' ' || *parser->current == '\t'
+               || *parser->current == '\r')) {
+        ++parser->current;
+    }
+}
+
+/* returns the end of the name at the current position, which is the
+   current position if there is none */
+static const char *name_end(const line_parser_t *parser)
+{
+    const char *current = parser->current;
+    if (current == parser->line_end
+        || !((*current >= 'a' && *current <= 'z')
+             || (*current >= 'A' && *current <= 'Z') || *current == '_')) {
+        return current;
+    }
+    return scan_find(current + 1, parser->line_end, SCAN_SPACE | SCAN_OTHER);
+}
+
+/* parses a decimal, hexadecimal (0x) or binary (0b) number with an
+   optional minus sign, which must fit in 64 bits before it is negated */
+static bool parse_number(line_parser_t *parser, uint64_t *number)
+{
+    const char *start = parser->current;
+    bool is_negative = *parser->current == '-';
+    if (is_negative) {
+        ++parser->current;
+    }
+    uint64_t value;
+    literal_status_t status = literal_parse(parser->current,
+                                            parser->line_end, &value,
+                                            &parser->current);
+    if (status == LITERAL_EMPTY) {
+        return parse_error(parser, "expected a number", start,
+                           parser->current);
+    }
+    if (status == LITERAL_OVERFLOW) {
+        return parse_error(parser, "number does not fit in 64 bits", start,
+                           parser->current);
+    }
+    *number = is_negative ? -value : value;
+    ++parser->tokens;
+    return true;
+}
+
+/* parses [register], [label] with an optional + or - number after the
+   register or label */
+static bool parse_memory(line_parser_t *parser, operand_t *operand)
+{
+    const char *start = parser->current;
+    ++parser->current;
+    skip_blanks(parser);
+    const char *end = name_end(parser);
+    if (end == parser->current) {
+        return parse_error(parser, "expected a base register or label",
+                           parser->current, parser->current + 1);
+    }
+    size_t size = end - parser->current;
+    int32_t i = perfect_hash_find(&register_table, parser->current, size);
+    operand->type = OPERAND_MEMORY;
+    if (i == -1) {
+        operand->label = symbol_table_intern(parser->labels,
+                                             parser->current, size);
+        if (operand->label == SYMBOL_NONE) {
+            return false;
+        }
+    }
+    else if (REGISTER_INFO[i].register_class == REGISTER_R64) {
+        operand->reg = REGISTER_INFO[i].id;
+    }
+    else {
+        return parse_error(parser, "a base register must be 64-bit",
+                           parser->current, end);
+    }
+    ++parser->tokens;
+    parser->current = end;
+    skip_blanks(parser);
+
+    if (parser->current != parser->line_end
+        && (*parser->current == '+' || *parser->current == '-')) {
+        bool is_negative = *parser->current == '-';
+        ++parser->current;
+        skip_blanks(parser);
+        const char *number_start = parser->current;
+        uint64_t number;
+        if (!parse_number(parser, &number)) {
+            return false;
+        }
+        if (number > (is_negative ? (uint64_t) INT32_MAX + 1 : INT32_MAX)) {
+            return parse_error(parser, "displacement does not fit in 32 bits",
+                               number_start, parser->current);
+        }
+        operand->displacement = is_negative ? -number : number;
+        skip_blanks(parser);
+    }
+    if (parser->current == parser->line_end || *parser->current != ']') {
+        return parse_error(parser, "expected ']'", start, parser->current);
+    }
+    ++parser->current;
+    if (parser->listing != NULL) {
+        fprintf(parser->listing, "%.*s memory\n",
+                (int) (parser->current - start), start);
+    }
+    return true;
+}
+
+static bool parse_operand(line_parser_t *parser, operand_t *operand)
+{
+    memset(operand, 0, sizeof(*operand));
+    operand->label = SYMBOL_NONE;
+    char c = *parser->current;
+    if (c == '[') {
+        return parse_memory(parser, operand);
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        operand->type = OPERAND_IMMEDIATE;
+        if (!parse_number(parser, &operand->immediate)) {
+            return false;
+        }
+        if (parser->listing != NULL) {
+            fprintf(parser->listing, "%" PRId64 " number\n",
+                    (int64_t) operand->immediate);
+        }
+        return true;
+    }
+
+    const char *start = parser->current;
+    const char *end = name_end(parser);
+    if (end == start) {
+        return parse_error(parser, "unexpected character", start, start + 1);
+    }
+    size_t size = end - start;
+    parser->current = end;
+    ++parser->tokens;
+    int32_t i = perfect_hash_find(&register_table, start, size);
+    if (i != -1) {
+        operand->type = OPERAND_REGISTER;
+        operand->register_class = REGISTER_INFO[i].register_class;
+        operand->reg = REGISTER_INFO[i].id;
+        if (parser->listing != NULL) {
+            fprintf(parser->listing, "%s register\n", REGISTER_INFO[i].name);
+        }
+        return true;
+    }
+    operand->type = OPERAND_LABEL;
+    operand->label = symbol_table_intern(parser->labels, start, size);
+    if (operand->label == SYMBOL_NONE) {
+        return false;
+    }
+    if (parser->listing != NULL) {
+        fprintf(parser->listing, "%.*s target\n", (int) size, start);
+    }
+    return true;
+}
+
+/* parses the comma separated operands up to the end of the line, returns the
+   number parsed or -1 */
+static int parse_operands(line_parser_t *parser, operand_t *operands)
+{
+    int operands_size = 0;
+    skip_blanks(parser);
+    while (parser->current != parser->line_end) {
+        if (operands_size == FORM_OPERANDS_MAX) {
+            parse_error(parser, "too many operands", parser->current,
+                        parser->line_end);
+            return -1;
+        }
+        if (!parse_operand(parser, &operands[operands_size])) {
+            return -1;
+        }
+        ++operands_size;
+        skip_blanks(parser);
+        if (parser->current == parser->line_end) {
+            break;
+        }
+        if (*parser->current != ',') {
+            parse_error(parser, "unexpected character", parser->current,
+                        parser->current + 1);
+            return -1;
+        }
+        ++parser->current;
+        skip_blanks(parser);
+        if (parser->current == parser->line_end) {
+            parse_error(parser, "expected an operand after ','",
+                        parser->current - 1, parser->current);
+            return -1;
+        }
+    }
+    return operands_size;
+}
+
+static bool append_data(instruction_buffer_t *buffer, uint64_t value,
+                        uint8_t size)
+{
+    instruction_t *instruction = instruction_buffer_append(buffer, INS_DATA);
+    if (instruction == NULL) {
+        return false;
+    }
+    instruction->size = size;
+    instruction->immediate = value;
+    return true;
+}
+
+/* packs byte into word, appending the word as data once it is full */
+static bool append_byte(instruction_buffer_t *buffer, uint64_t *word,
+                        uint8_t *word_size, uint8_t byte)
+{
+    *word |= (uint64_t) byte << (8 * *word_size);
+    ++*word_size;
+    if (*word_size < 8) {
+        return true;
+    }
+    uint64_t full = *word;
+    *word = 0;
+    *word_size = 0;
+    return append_data(buffer, full, 8);
+}
+
+/* parses a quoted string with C escapes, appending its bytes and a null
+   terminator if is_terminated as data of up to 8 bytes each */
+static bool parse_string(line_parser_t *parser, instruction_buffer_t *buffer,
+                         bool is_terminated)
+{
+    const char *start = parser->current;
+    if (*parser->current != '"') {
+        return parse_error(parser, "expected a string", start, start + 1);
+    }
+    ++parser->current;
+    uint64_t word = 0;
+    uint8_t word_size = 0;
+    while (true) {
+        if (parser->current == parser->line_end) {
+            return parse_error(parser, "expected '\"'", start,
+                               parser->current);
+        }
+        char c = *parser->current;
+        ++parser->current;
+        if (c == '"') {
+            break;
+        }
+        if (c == '\\' && parser->current != parser->line_end) {
+            c = *parser->current;
+            ++parser->current;
+            switch (c) {
+            case 'n':
+                c = '\n';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case '0':
+                c = '\0';
+                break;
+            case '\\':
+            case '"':
+                break;
+            default:
+                return parse_error(parser, "unknown escape",
+                                   parser->current - 2, parser->current);
+            }
+        }
+        if (!append_byte(buffer, &word, &word_size, c)) {
+            return false;
+        }
+    }
+    if (is_terminated && !append_byte(buffer, &word, &word_size, 0)) {
+        return false;
+    }
+    if (word_size != 0 && !append_data(buffer, word, word_size)) {
+        return false;
+    }
+    ++parser->tokens;
+    if (parser->listing != NULL) {
+        fprintf(parser->listing, "%.*s string\n",
+                (int) (parser->current - start), start);
+    }
+    return true;
+}
+
+/* parses the operands of a directive up to the end of the line */
+static bool parse_directive(line_parser_t *parser,
+                            const directive_info_t *info,
+                            instruction_buffer_t *buffers)
+{
+    instruction_buffer_t *buffer = &buffers[parser->section];
+    skip_blanks(parser);
+    switch (info->id) {
+    case DIR_SECTION:
+        parser->section = info->value;
+        break;
+    case DIR_DATA:
+        while (true) {
+            const char *start = parser->current;
+            uint64_t number;
+            if (start == parser->line_end) {
+                return parse_error(parser, "expected a number", start, start);
+            }
+            if (!parse_number(parser, &number)) {
+                return false;
+            }
+            /* signed and unsigned values both fit */
+            unsigned bits = 8 * info->value;
+            int64_t value = number;
+            if (bits < 64 && (value < -((int64_t) 1 << (bits - 1))
+                              || value >= (int64_t) 1 << bits)) {
+                return parse_error(parser, "value does not fit", start,
+                                   parser->current);
+            }
+            if (!append_data(buffer, number, info->value)) {
+                return false;
+            }
+            if (parser->listing != NULL) {
+                fprintf(parser->listing, "%" PRId64 " number\n", value);
+            }
+            skip_blanks(parser);
+            if (parser->current == parser->line_end
+                || *parser->current != ',') {
+                break;
+            }
+            ++parser->current;
+            skip_blanks(parser);
+        }
+        break;
+    case DIR_SPACE:
+        {
+            const char *start = parser->current;
+            uint64_t size;
+            if (start == parser->line_end || *start == '-') {
+                return parse_error(parser, "expected a size", start,
+                                   start == parser->line_end ? start
+                                                             : start + 1);
+            }
+            if (!parse_number(parser, &size)) {
+                return false;
+            }
+            instruction_t *instruction =
+                instruction_buffer_append(buffer, INS_SPACE);
+            if (instruction == NULL) {
+                return false;
+            }
+            instruction->immediate = size;
+            if (parser->listing != NULL) {
+                fprintf(parser->listing, "%" PRIu64 " number\n", size);
+            }
+        }
+        break;
+    case DIR_ASCII:
+        while (true) {
+            if (parser->current == parser->line_end) {
+                return parse_error(parser, "expected a string",
+                                   parser->current, parser->current);
+            }
+            if (!parse_string(parser, buffer, info->value)) {
+                return false;
+            }
+            skip_blanks(parser);
+            if (parser->current == parser->line_end
+                || *parser->current != ',') {
+                break;
+            }
+            ++parser->current;
+            skip_blanks(parser);
+        }
+        break;
+    case DIR_ALIGN:
+        {
+            /* the largest alignment a section can have */
+            static const unsigned LOG2_MAX = 12;
+            const char *start = parser->current;
+            uint64_t value;
+            if (start == parser->line_end || *start == '-') {
+                return parse_error(parser, "expected an alignment", start,
+                                   start == parser->line_end ? start
+                                                             : start + 1);
+            }
+            if (!parse_number(parser, &value)) {
+                return false;
+            }
+            unsigned log2 = value;
+            if (info->value == 0) {
+                log2 = value == 0 ? 0 : __builtin_ctzll(value);
+                if (value == 0 || value != (uint64_t) 1 << log2) {
+                    log2 = LOG2_MAX + 1;
+                }
+            }
+            if (value > ((uint64_t) 1 << LOG2_MAX) || log2 > LOG2_MAX) {
+                return parse_error(parser, "alignment is not a power of two"
+                                   " up to 4096", start, parser->current);
+            }
+            instruction_t *instruction =
+                instruction_buffer_append(buffer, INS_ALIGN);
+            if (instruction == NULL) {
+                return false;
+            }
+            instruction->reg = log2;
+            uint64_t *alignment = &parser->alignments[parser->section];
+            if (*alignment < (uint64_t) 1 << log2) {
+                *alignment = (uint64_t) 1 << log2;
+            }
+            if (parser->listing != NULL) {
+                fprintf(parser->listing, "%" PRIu64 " number\n", value);
+            }
+        }
+        break;
+    case DIR_SYMBOL:
+        while (true) {
+            const char *start = parser->current;
+            const char *end = name_end(parser);
+            if (end == start) {
+                return parse_error(parser, "expected a label", start,
+                                   start == parser->line_end ? start
+                                                             : start + 1);
+            }
+            uint32_t label = symbol_table_intern(parser->labels, start,
+                                                 end - start);
+            if (label == SYMBOL_NONE) {
+                return false;
+            }
+            parser->labels->symbols[label].flags |= info->value;
+            parser->current = end;
+            if (parser->listing != NULL) {
+                fprintf(parser->listing, "%.*s symbol\n",
+                        (int) (end - start), start);
+            }
+            skip_blanks(parser);
+            if (parser->current == parser->line_end
+                || *parser->current != ',') {
+                break;
+            }
+            ++parser->current;
+            skip_blanks(parser);
+        }
+        break;
+    }
+    skip_blanks(parser);
+    if (parser->current != parser->line_end) {
+        return parse_error(parser, "unexpected character", parser->current,
+                           parser->current + 1);
+    }
+    return true;
+}
+
+/* parses [current, input_end) into the buffers, label operands are ids in
+   labels until the jobs are linked, the listing goes to listing unless it is
+   NULL, the number of tokens read is added to tokens_size. An instruction
+   or directive and its operands take one line. On a syntax error the
+   parser's error is set, otherwise false means an allocation failed. */
+static bool parse(const char *current, const char *input_end,
+                  instruction_buffer_t *buffers, line_parser_t *parser)
+{
+    const char *input_start = current;
+    while (true) {
+        /* names start with a letter and may contain digits (r8, xmm15) */
+        const char *start = scan_find(current, input_end, SCAN_LETTER);
+        if (start == input_end) {
+            break;
+        }
+        current = scan_find(start + 1, input_end, SCAN_SPACE | SCAN_OTHER);
+        size_t size = current - start;
+        ++parser->tokens;
+        instruction_buffer_t *instructions = &buffers[parser->section];
+
+        if (start != input_start && start[-1] == '.') {
+            int32_t i = perfect_hash_find(&directive_table, start, size);
+            if (i == -1) {
+                return parse_error(parser, "unknown directive", start - 1,
+                                   current);
+            }
+            if (parser->listing != NULL) {
+                fprintf(parser->listing, ".%s directive\n",
+                        DIRECTIVE_INFO[i].name);
+            }
+            parser->current = current;
+            parser->line_end = memchr(current, '\n', input_end - current);
+            if (parser->line_end == NULL) {
+                parser->line_end = input_end;
+            }
+            if (!parse_directive(parser, &DIRECTIVE_INFO[i], buffers)) {
+                return false;
+            }
+            current = parser->line_end;
+            continue;
+        }
+
+        if (current != input_end && *current == ':') {
+            uint32_t label = symbol_table_intern(parser->labels, start, size);
+            instruction_t *instruction =
+                instruction_buffer_append(instructions, INS_LABEL);
+            if (label == SYMBOL_NONE || instruction == NULL) {
+                return false;
+            }
+            instruction->label = label;
+            ++parser->labels->symbols[label].definitions;
+            ++current;
+            if (parser->listing != NULL) {
+                fprintf(parser->listing, "%.*s label\n", (int) size, start);
+            }
+            continue;
+        }
+
+        int32_t value = perfect_hash_find(&mnemonic_table, start, size);
+        if (value == -1) {
+            return parse_error(parser, "unknown mnemonic", start, current);
+        }
+        if (parser->listing != NULL) {
+            fprintf(parser->listing, "%.*s mnemonic\n", (int) size, start);
+        }
+
+        parser->current = current;
+        parser->line_end = memchr(current, '\n', input_end - current);
+        if (parser->line_end == NULL) {
+            parser->line_end = input_end;
+        }
+        operand_t operands[FORM_OPERANDS_MAX];
+        int operands_size = parse_operands(parser, operands);
+        if (operands_size == -1) {
+            return false;
+        }
+        current = parser->line_end;
+
+        instruction_t *instruction;
+        if (value & MNEMONIC_FORMS) {
+            int32_t form = instruction_form_match(MNEMONIC_FORMS_FIRST(value),
+                                                  MNEMONIC_FORMS_SIZE(value),
+                                                  operands, operands_size);
+            if (form == -1) {
+                return parse_error(parser, "no form takes these operands",
+                                   start, parser->line_end);
+            }
+            instruction = instruction_buffer_append(instructions, INS_FORM);
+            if (instruction == NULL) {
+                return false;
+            }
+            instruction_set_form(instruction, form, operands);
+            continue;
+        }
+
+        if (operands_size != 1 || operands[0].type != OPERAND_LABEL) {
+            return parse_error(parser, "a branch takes one label",
+                               start, parser->line_end);
+        }
+        const mnemonic_info_t *info = &MNEMONIC_INFO[value];
+        switch (info->id) {
+        case MNE_JMP:
+            instruction = instruction_buffer_append(instructions, INS_JMP);
+            break;
+        case MNE_JCC:
+            instruction = instruction_buffer_append(instructions, INS_JCC);
+            break;
+        case MNE_CALL:
+        default:
+            instruction = instruction_buffer_append(instructions, INS_CALL);
+            break;
+        }
+        if (instruction == NULL) {
+            return false;
+        }
+        instruction->reg = info->condition;
+        instruction->label = operands[0].label;
+    }
+    return true;
+}
+
+static void *parse_job(void *arg)
+{
+    assemble_job_t *job = arg;
+    line_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.labels = &job->labels;
+    parser.section = JOB_INHERITED;
+    memset(job->alignments, 0, sizeof(job->alignments));
+    parser.alignments = job->alignments;
+    parser.listing = job->listing;
+    job->is_done = parse(job->start, job->end, job->buffers, &parser);
+    job->end_section = parser.section;
+    job->tokens_size = parser.tokens;
+    job->error = parser.error;
+    job->error_start = parser.error_start;
+    job->error_end = parser.error_end;
+    return NULL;
+}
+
+static void *encode_job(void *arg)
+{
+    assemble_job_t *job = arg;
+    for (size_t i = 0; i <= JOB_INHERITED; ++i) {
+        if (job->destinations[i] != NULL) {
+            size_t section = i == JOB_INHERITED ? job->inherited_section : i;
+            encode_instructions(&job->buffers[i], job->label_addresses,
+                                job->destinations[i],
+                                section == SECTION_TEXT);
+        }
+    }
+    job->is_done = true;
+    return NULL;
+}
+
+/* runs function on every job, each on its own thread if there is more than
+   one, and returns whether they all succeeded */
+static bool run_jobs(assemble_job_t *jobs, size_t jobs_size,
+                     void *(*function)(void *))
+{
+    bool is_threaded = jobs_size > 1;
+    for (size_t i = 0; i < jobs_size; ++i) {
+        assemble_job_t *job = &jobs[i];
+        job->is_done = false;
+        if (!is_threaded
+            || pthread_create(&job->thread, NULL, function, job) != 0) {
+            function(job);
+            job->thread = pthread_self();
+        }
+    }
+
+    bool is_done = true;
+    for (size_t i = 0; i < jobs_size; ++i) {
+        assemble_job_t *job = &jobs[i];
+        if (is_threaded && !pthread_equal(job->thread, pthread_self())) {
+            pthread_join(job->thread, NULL);
+        }
+        if (!job->is_done) {
+            is_done = false;
+        }
+    }
+    return is_done;
+}
+
+/* splits the input into jobs_size pieces ending at line boundaries, an
+   instruction never spans lines so every piece parses on its own */
+static void split_input(const char *input, size_t input_size,
+                        assemble_job_t *jobs, size_t jobs_size)
+{
+    const char *start = input;
+    const char *input_end = input + input_size;
+    for (size_t i = 0; i < jobs_size; ++i) {
+        const char *end = input + input_size / jobs_size * (i + 1);
+        if (i + 1 == jobs_size) {
+            end = input_end;
+        }
+        if (end < start) {
+            end = start;
+        }
+        if (end != input_end) {
+            end = memchr(end, '\n', input_end - end);
+            end = end == NULL ? input_end : end + 1;
+        }
+        jobs[i].start = start;
+        jobs[i].end = end;
+        start = end;
+    }
+}
+
+/* appends a line to the diagnostics, a message there is no memory for is
+   dropped */
+static void diagnose(assembly_t *assembly, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    int size = vsnprintf(NULL, 0, format, arguments);
+    va_end(arguments);
+    if (size < 0) {
+        return;
+    }
+
+    /* room for the newline and the terminating null */
+    size_t needed = assembly->diagnostics_size + size + 2;
+    if (needed > assembly->diagnostics_capacity) {
+        size_t capacity = assembly->diagnostics_capacity
+            ? assembly->diagnostics_capacity * 2 : 256;
+        if (capacity < needed) {
+            capacity = needed;
+        }
+        char *diagnostics = realloc(assembly->diagnostics, capacity);
+        if (diagnostics == NULL) {
+            return;
+        }
+        assembly->diagnostics = diagnostics;
+        assembly->diagnostics_capacity = capacity;
+    }
+    char *end = assembly->diagnostics + assembly->diagnostics_size;
+    va_start(arguments, format);
+    vsnprintf(end, size + 1, format, arguments);
+    va_end(arguments);
+    end[size] = '\n';
+    end[size + 1] = '\0';
+    assembly->diagnostics_size += size + 1;
+}
+
+/* replaces the job local label ids with ids in the assembly's
+   labels, this is where label references that cross jobs are resolved */
+static bool link_labels(assembly_t *assembly)
+{
+    assemble_job_t *jobs = assembly->jobs;
+    size_t jobs_size = assembly->jobs_size;
+    symbol_table_t *labels = &assembly->labels;
+    for (size_t j = 0; j < jobs_size; ++j) {
+        assemble_job_t *job = &jobs[j];
+        size_t local_size = job->labels.symbols_size;
+        uint32_t *ids = malloc((local_size + 1) * sizeof(*ids));
+        if (ids == NULL) {
+            diagnose(assembly, "allocating label ids: %s", strerror(errno));
+            return false;
+        }
+        for (size_t i = 0; i < local_size; ++i) {
+            symbol_t *local = &job->labels.symbols[i];
+            ids[i] = symbol_table_intern(labels, local->name,
+                                         local->name_size);
+            if (ids[i] == SYMBOL_NONE) {
+                diagnose(assembly, "allocating labels: %s", strerror(errno));
+                free(ids);
+                return false;
+            }
+            labels->symbols[ids[i]].definitions += local->definitions;
+            labels->symbols[ids[i]].flags |= local->flags;
+        }
+        for (size_t b = 0; b <= JOB_INHERITED; ++b) {
+            instruction_buffer_t *buffer = &job->buffers[b];
+            for (size_t i = 0; i < buffer->size; ++i) {
+                instruction_t *instruction = &buffer->instructions[i];
+                if (instruction_has_label(instruction)) {
+                    instruction->label = ids[instruction->label];
+                }
+            }
+        }
+        free(ids);
+    }
+
+    bool is_linked = true;
+    assembly->entry_label = SYMBOL_NONE;
+    for (size_t i = 0; i < labels->symbols_size; ++i) {
+        symbol_t *label = &labels->symbols[i];
+        if (label->name_size == 6 && memcmp(label->name, "_start", 6) == 0) {
+            assembly->entry_label = i;
+        }
+        /* an object file leaves declared labels to the linker */
+        bool is_external = assembly->is_relocatable && label->flags != 0;
+        if (label->definitions == 0 && !is_external) {
+            diagnose(assembly, "undefined label '%.*s'",
+                    (int) label->name_size, label->name);
+            is_linked = false;
+        }
+        else if (label->definitions > 1) {
+            diagnose(assembly, "label '%.*s' defined more than once",
+                    (int) label->name_size, label->name);
+            is_linked = false;
+        }
+    }
+    return is_linked;
+}
+
+void assembly_init(assembly_t *assembly)
+{
+    memset(assembly, 0, sizeof(*assembly));
+    symbol_table_init(&assembly->labels);
+    assembly->text_alignment = LAYOUT_PAGE_SIZE;
+    code_buffer_init(&assembly->code);
+}
+
+/* closes the job's listing stream if an earlier parse failed with it open */
+static void close_job_listing(assemble_job_t *job, FILE *listing)
+{
+    if (job->listing != NULL && job->listing != listing) {
+        fclose(job->listing);
+    }
+    job->listing = NULL;
+    free(job->listing_buffer);
+    job->listing_buffer = NULL;
+    job->listing_size = 0;
+}
+
+void assembly_fini(assembly_t *assembly)
+{
+    for (size_t i = 0; i < assembly->jobs_capacity; ++i) {
+        assemble_job_t *job = &assembly->jobs[i];
+        close_job_listing(job, assembly->listing);
+        for (size_t b = 0; b <= JOB_INHERITED; ++b) {
+            instruction_buffer_fini(&job->buffers[b]);
+        }
+        symbol_table_fini(&job->labels);
+    }
+    free(assembly->buffers);
+    free(assembly->label_addresses);
+    symbol_table_fini(&assembly->labels);
+    code_buffer_fini(&assembly->code);
+    free(assembly->jobs);
+    free(assembly->diagnostics);
+    memset(assembly, 0, sizeof(*assembly));
+}
+
+/* makes room for jobs_size jobs, keeping the buffers of existing ones */
+static bool reserve_jobs(assembly_t *assembly, size_t jobs_size)
+{
+    if (jobs_size <= assembly->jobs_capacity) {
+        return true;
+    }
+    instruction_buffer_t **buffers =
+        realloc(assembly->buffers,
+                jobs_size * (JOB_INHERITED + 1) * sizeof(*buffers));
+    if (buffers == NULL) {
+        return false;
+    }
+    assembly->buffers = buffers;
+    assemble_job_t *jobs = realloc(assembly->jobs, jobs_size * sizeof(*jobs));
+    if (jobs == NULL) {
+        return false;
+    }
+    assembly->jobs = jobs;
+    for (size_t i = assembly->jobs_capacity; i < jobs_size; ++i) {
+        assemble_job_t *job = &jobs[i];
+        memset(job, 0, sizeof(*job));
+        for (size_t b = 0; b <= JOB_INHERITED; ++b) {
+            instruction_buffer_init(&job->buffers[b]);
+        }
+        symbol_table_init(&job->labels);
+    }
+    assembly->jobs_capacity = jobs_size;
+    return true;
+}
+
+/* Each job's instructions before its first section directive go in the
+   section the job before it ended in, which is only known now. Groups every
+   buffer by section in input order, returns false if anything but labels
+   and .zero went in .bss. */
+static bool group_sections(assembly_t *assembly)
+{
+    assemble_job_t *jobs = assembly->jobs;
+    uint8_t section = SECTION_TEXT;
+    for (size_t i = 0; i < assembly->jobs_size; ++i) {
+        jobs[i].inherited_section = section;
+        if (jobs[i].end_section != JOB_INHERITED) {
+            section = jobs[i].end_section;
+        }
+    }
+
+    instruction_buffer_t **buffers = assembly->buffers;
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        assembly->section_buffers[s] = buffers;
+        uint64_t *alignment = &assembly->section_alignments[s];
+        *alignment = 1;
+        for (size_t i = 0; i < assembly->jobs_size; ++i) {
+            if (jobs[i].inherited_section == s) {
+                *buffers++ = &jobs[i].buffers[JOB_INHERITED];
+                if (*alignment < jobs[i].alignments[JOB_INHERITED]) {
+                    *alignment = jobs[i].alignments[JOB_INHERITED];
+                }
+            }
+            *buffers++ = &jobs[i].buffers[s];
+            if (*alignment < jobs[i].alignments[s]) {
+                *alignment = jobs[i].alignments[s];
+            }
+        }
+        assembly->section_buffers_sizes[s] =
+            buffers - assembly->section_buffers[s];
+    }
+
+    for (size_t b = 0; b < assembly->section_buffers_sizes[SECTION_BSS];
+         ++b) {
+        const instruction_buffer_t *buffer =
+            assembly->section_buffers[SECTION_BSS][b];
+        for (size_t i = 0; i < buffer->size; ++i) {
+            uint8_t op = buffer->instructions[i].op;
+            if (op != INS_LABEL && op != INS_SPACE && op != INS_ALIGN) {
+                diagnose(assembly,
+                         "only labels, .zero and .align can go in .bss");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Lays out the sections other than .text at address, which also leaves
+   their labels there while .text is relaxed. A branch from .text to one of
+   them then never fits in rel8, so it is sized for wherever they end up. */
+static void lay_out_data(assembly_t *assembly, uint64_t *sizes,
+                         const uint64_t *addresses)
+{
+    for (size_t s = SECTION_RODATA; s < SECTIONS_SIZE; ++s) {
+        sizes[s] = relax_branches(assembly->section_buffers[s],
+                                  assembly->section_buffers_sizes[s],
+                                  addresses[s], assembly->label_addresses);
+    }
+}
+
+bool assembly_parse(assembly_t *assembly, const char *input,
+                    size_t input_size, size_t threads, FILE *listing)
+{
+    assembly->diagnostics_size = 0;
+    if (assembly->diagnostics != NULL) {
+        assembly->diagnostics[0] = '\0';
+    }
+    for (size_t i = 0; i < assembly->jobs_capacity; ++i) {
+        close_job_listing(&assembly->jobs[i], assembly->listing);
+    }
+    symbol_table_clear(&assembly->labels);
+    code_buffer_clear(&assembly->code);
+    memset(&assembly->layout, 0, sizeof(assembly->layout));
+    memset(assembly->section_bytes, 0, sizeof(assembly->section_bytes));
+    assembly->listing = listing;
+    assembly->tokens_size = 0;
+    assembly->parse_seconds = 0;
+    assembly->layout_seconds = 0;
+    assembly->encode_seconds = 0;
+
+    size_t jobs_size = input_size / PARALLEL_JOB_MIN_SIZE;
+    if (jobs_size > threads) {
+        jobs_size = threads;
+    }
+    if (jobs_size == 0) {
+        jobs_size = 1;
+    }
+    if (!reserve_jobs(assembly, jobs_size)) {
+        diagnose(assembly, "allocating jobs: %s", strerror(errno));
+        return false;
+    }
+    assemble_job_t *jobs = assembly->jobs;
+    assembly->jobs_size = jobs_size;
+    split_input(input, input_size, jobs, jobs_size);
+
+    for (size_t i = 0; i < jobs_size; ++i) {
+        assemble_job_t *job = &jobs[i];
+        for (size_t b = 0; b <= JOB_INHERITED; ++b) {
+            instruction_buffer_clear(&job->buffers[b]);
+        }
+        symbol_table_clear(&job->labels);
+        job->tokens_size = 0;
+        /* each job lists into memory so the listing stays in input order */
+        job->listing = listing;
+        if (listing != NULL && jobs_size > 1) {
+            job->listing = open_memstream(&job->listing_buffer,
+                                          &job->listing_size);
+            if (job->listing == NULL) {
+                diagnose(assembly, "opening listing stream: %s", strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    double start = now();
+    bool is_parsed = run_jobs(jobs, jobs_size, parse_job);
+    for (size_t i = 0; i < jobs_size; ++i) {
+        assemble_job_t *job = &jobs[i];
+        assembly->tokens_size += job->tokens_size;
+        if (job->listing != NULL && job->listing != listing) {
+            fclose(job->listing);
+            job->listing = NULL;
+            fwrite(job->listing_buffer, 1, job->listing_size, listing);
+        }
+    }
+    assembly->parse_seconds = now() - start;
+    start = now();
+    if (!is_parsed) {
+        for (size_t i = 0; i < jobs_size; ++i) {
+            assemble_job_t *job = &jobs[i];
+            if (job->is_done) {
+                continue;
+            }
+            if (job->error == NULL) {
+                diagnose(assembly, "allocating instructions failed");
+                continue;
+            }
+            /* lines are only counted once something is wrong */
+            size_t line = 1;
+            for (const char *c = input; c != job->error_start; ++c) {
+                line += *c == '\n';
+            }
+            diagnose(assembly, "line %zu: %s '%.*s'", line, job->error,
+                     (int) (job->error_end - job->error_start),
+                     job->error_start);
+        }
+        return false;
+    }
+    if (!link_labels(assembly) || !group_sections(assembly)) {
+        return false;
+    }
+
+    size_t labels_size = assembly->labels.symbols_size + 1;
+    if (labels_size > assembly->label_addresses_capacity) {
+        uint64_t *label_addresses =
+            realloc(assembly->label_addresses,
+                    labels_size * sizeof(*label_addresses));
+        if (label_addresses == NULL) {
+            diagnose(assembly, "allocating layout: %s", strerror(errno));
+            return false;
+        }
+        assembly->label_addresses = label_addresses;
+        assembly->label_addresses_capacity = labels_size;
+    }
+    for (size_t i = 0; i < jobs_size; ++i) {
+        jobs[i].label_addresses = assembly->label_addresses;
+    }
+    instruction_buffer_t **text = assembly->section_buffers[SECTION_TEXT];
+    size_t text_size = assembly->section_buffers_sizes[SECTION_TEXT];
+    peephole_optimize(text, text_size);
+    if (!select_encodings(text, text_size, assembly->labels.symbols_size)) {
+        diagnose(assembly, "allocating flags liveness: %s", strerror(errno));
+        return false;
+    }
+    uint64_t loop_alignment = assembly->loop_alignment;
+    if (loop_alignment > 1) {
+        if (!align_loops(text, text_size, assembly->labels.symbols_size,
+                         __builtin_ctzll(loop_alignment))) {
+            diagnose(assembly, "allocating loop heads: %s", strerror(errno));
+            return false;
+        }
+        if (assembly->section_alignments[SECTION_TEXT] < loop_alignment) {
+            assembly->section_alignments[SECTION_TEXT] = loop_alignment;
+        }
+    }
+
+    /* The other sections are sized far apart from the text and each other
+       first, so no branch between sections is short. An object file keeps
+       them there, with every external label further still. */
+    uint64_t addresses[SECTIONS_SIZE];
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        addresses[s] = s * LAYOUT_SECTION_SPACING;
+    }
+    if (assembly->is_relocatable) {
+        for (size_t i = 0; i < assembly->labels.symbols_size; ++i) {
+            if (assembly->labels.symbols[i].definitions == 0) {
+                assembly->label_addresses[i] =
+                    SECTIONS_SIZE * LAYOUT_SECTION_SPACING;
+            }
+        }
+    }
+    uint64_t sizes[SECTIONS_SIZE] = { 0 };
+    lay_out_data(assembly, sizes, addresses);
+    layout_t *layout = &assembly->layout;
+    if (assembly->is_relocatable) {
+        sizes[SECTION_TEXT] = relax_branches(text, text_size,
+                                             addresses[SECTION_TEXT],
+                                             assembly->label_addresses);
+        layout_object(layout, sizes, assembly->section_alignments);
+        assembly->entry = 0;
+        assembly->layout_seconds = now() - start;
+        return true;
+    }
+
+    /* where the text starts only depends on which sections are empty */
+    layout_sections(layout, sizes, assembly->section_alignments,
+                    assembly->text_alignment);
+    sizes[SECTION_TEXT] = relax_branches(text, text_size,
+                                         layout->sections[SECTION_TEXT].address,
+                                         assembly->label_addresses);
+    layout_sections(layout, sizes, assembly->section_alignments,
+                    assembly->text_alignment);
+    /* branches only grow, so moving the other sections near the text
+       leaves their sizes alone */
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        addresses[s] = layout->sections[s].address;
+    }
+    lay_out_data(assembly, sizes, addresses);
+    assembly->entry = assembly->entry_label == SYMBOL_NONE
+        ? layout->sections[SECTION_TEXT].address
+        : assembly->label_addresses[assembly->entry_label];
+    assembly->layout_seconds = now() - start;
+    return true;
+}
+
+/* Without bytes, everything after the headers is appended to the code in
+   file order, each section in one piece so it can be found again, with the
+   padding between them zeroed. */
+bool assembly_encode(assembly_t *assembly, uint8_t *bytes)
+{
+    double start = now();
+    const layout_t *layout = &assembly->layout;
+    uint64_t offset = layout->headers_size;
+    for (size_t s = 0; s < SECTION_BSS; ++s) {
+        const section_layout_t *section = &layout->sections[s];
+        if (section->size == 0) {
+            assembly->section_bytes[s] = NULL;
+            continue;
+        }
+        if (bytes != NULL) {
+            assembly->section_bytes[s] = bytes + section->offset;
+            continue;
+        }
+        uint8_t *padding = code_buffer_append(&assembly->code,
+                                              section->offset - offset);
+        assembly->section_bytes[s] = code_buffer_append(&assembly->code,
+                                                        section->size);
+        if (padding == NULL || assembly->section_bytes[s] == NULL) {
+            diagnose(assembly, "allocating machine code: %s", strerror(errno));
+            return false;
+        }
+        memset(padding, 0, section->offset - offset);
+        offset = section->offset + section->size;
+    }
+    if (bytes == NULL && offset < layout->file_size) {
+        /* a segment of only .bss still starts on a page in the file */
+        uint8_t *padding = code_buffer_append(&assembly->code,
+                                              layout->file_size - offset);
+        if (padding == NULL) {
+            diagnose(assembly, "allocating machine code: %s", strerror(errno));
+            return false;
+        }
+        memset(padding, 0, layout->file_size - offset);
+    }
+
+    for (size_t i = 0; i < assembly->jobs_size; ++i) {
+        assemble_job_t *job = &assembly->jobs[i];
+        for (size_t b = 0; b <= JOB_INHERITED; ++b) {
+            size_t s = b == JOB_INHERITED ? job->inherited_section : b;
+            const instruction_buffer_t *buffer = &job->buffers[b];
+            job->destinations[b] = NULL;
+            if (s != SECTION_BSS && buffer->size != 0
+                && assembly->section_bytes[s] != NULL) {
+                job->destinations[b] = assembly->section_bytes[s]
+                    + (buffer->address - layout->sections[s].address);
+            }
+        }
+    }
+    run_jobs(assembly->jobs, assembly->jobs_size, encode_job);
+    assembly->encode_seconds = now() - start;
+    return true;
+}
+
+bool assembly_assemble(assembly_t *assembly, const char *source,
+                       size_t size)
+{
+    return assembly_parse(assembly, source, size, 1, NULL)
+        && assembly_encode(assembly, NULL);
+}
@@ -0,0 +1,146 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef EYL_ASSEMBLER_H
+#define EYL_ASSEMBLER_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* POSIX */
+#include <pthread.h>
+
+#include "code_buffer.h"
+#include "encode.h"
+#include "layout.h"
+#include "symbol_table.h"
+
+/* Assembles source text in memory. assembler_build_tables must succeed once
+   before any assembly is parsed. An assembly is used by one thread at a
+   time, but it may split a large input across threads itself.
+
+       assembly_t assembly;
+       assembly_init(&assembly);
+       if (assembly_assemble(&assembly, source, size)) {
+           ... assembly.section_bytes[SECTION_TEXT] holds
+               assembly.layout.sections[SECTION_TEXT].size bytes ...
+       }
+       else {
+           ... assembly.diagnostics says why ...
+       }
+       assembly_fini(&assembly);
+*/
+
+/* the buffer of a job's instructions before its first section directive */
+#define JOB_INHERITED SECTIONS_SIZE
+
+/* a piece of the input, parsed and encoded on its own thread */
+typedef struct {
+    const char *start;
+    const char *end;
+    /* one buffer per section and one for the instructions before the first
+       section directive, which are in the section the previous job ended
+       in, each is encoded to its destination (NULL for .bss) */
+    instruction_buffer_t buffers[SECTIONS_SIZE + 1];
+    uint8_t *destinations[SECTIONS_SIZE + 1];
+    uint8_t inherited_section; /* of the JOB_INHERITED buffer */
+    uint8_t end_section; /* JOB_INHERITED if there is no section directive */
+    uint64_t alignments[SECTIONS_SIZE + 1]; /* the largest in each buffer */
+    symbol_table_t labels;
+    FILE *listing;
+    char *listing_buffer;
+    size_t listing_size;
+    uint64_t tokens_size;
+    const char *error; /* why parsing stopped, NULL if it was not the input */
+    const char *error_start;
+    const char *error_end;
+    const uint64_t *label_addresses;
+    bool is_done;
+    pthread_t thread;
+} assemble_job_t;
+
+/* Everything an input is assembled with. The jobs, tables and buffers are
+   cleared rather than freed between inputs, so assembling many small inputs
+   with one assembly only allocates for the first few. */
+typedef struct {
+    assemble_job_t *jobs;
+    size_t jobs_size;
+    size_t jobs_capacity; /* jobs with initialized buffers */
+    symbol_table_t labels;
+    uint64_t *label_addresses;
+    size_t label_addresses_capacity;
+    uint32_t entry_label; /* _start, or SYMBOL_NONE */
+
+    /* every job's buffers grouped by section in input order */
+    instruction_buffer_t **buffers;
+    instruction_buffer_t **section_buffers[SECTIONS_SIZE];
+    size_t section_buffers_sizes[SECTIONS_SIZE];
+    uint64_t section_alignments[SECTIONS_SIZE]; /* the largest in each */
+
+    uint64_t text_alignment; /* LAYOUT_PAGE_SIZE unless set before parsing */
+    /* lays out an object file for a linker instead of an executable if set
+       before parsing, labels declared with .globl or .extern may then be
+       undefined */
+    bool is_relocatable;
+    /* the targets of backward branches in the text are aligned to this
+       power of two if it is set before parsing, 0 leaves them be */
+    uint64_t loop_alignment;
+    layout_t layout;
+    uint64_t entry; /* the address of _start, or of the text */
+
+    /* everything in the file after the headers, unless it was encoded
+       elsewhere, and where each section but .bss was encoded to */
+    code_buffer_t code;
+    uint8_t *section_bytes[SECTIONS_SIZE];
+
+    /* why the last parse failed, one message per line */
+    char *diagnostics;
+    size_t diagnostics_size;
+    size_t diagnostics_capacity;
+
+    FILE *listing; /* NULL unless a listing was asked for */
+    uint64_t tokens_size;
+    double parse_seconds;
+    double layout_seconds;
+    double encode_seconds;
+} assembly_t;
+
+bool assembler_build_tables(void);
+void assembler_free_tables(void);
+
+void assembly_init(assembly_t *assembly);
+void assembly_fini(assembly_t *assembly);
+
+/* parses the input, splitting it across up to threads jobs if it is large
+   enough, and lays it out so the layout of the file is known, the listing
+   goes to listing unless it is NULL */
+bool assembly_parse(assembly_t *assembly, const char *input,
+                    size_t input_size, size_t threads, FILE *listing);
+
+/* encodes every section straight into bytes at its offset in the file if
+   bytes is not NULL, which must then have room for layout.file_size zeroed
+   bytes, otherwise into code */
+bool assembly_encode(assembly_t *assembly, uint8_t *bytes);
+
+/* parses and encodes the source on the calling thread into code */
+bool assembly_assemble(assembly_t *assembly, const char *source,
+                       size_t size);
+
+#endif
@@ -0,0 +1,263 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#define _XOPEN_SOURCE 700
+
+#include "cache.h"
+
+/* C */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char CACHE_MAGIC[8] = "EYLCACHE";
+
+/* an entry is this header and then the output file */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t input_size;
+    uint64_t output_size;
+} cache_header_t;
+
+static const uint64_t PRIME_1 = 0x9e3779b185ebca87;
+static const uint64_t PRIME_2 = 0xc2b2ae3d27d4eb4f;
+
+static uint64_t rotate(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t load(const uint8_t *bytes)
+{
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+/* four independent multiply-rotate lanes over 32 byte blocks keep the
+   multipliers busy, the tail is folded in a word at a time */
+static uint64_t hash_bytes(const void *input, size_t size, uint64_t seed)
+{
+    const uint8_t *bytes = input;
+    const uint8_t *end = bytes + size;
+    uint64_t lanes[4] = {
+        seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1
+    };
+    for (; end - bytes >= 32; bytes += 32) {
+        for (int i = 0; i < 4; ++i) {
+            lanes[i] += load(bytes + 8 * i) * PRIME_2;
+            lanes[i] = rotate(lanes[i], 31) * PRIME_1;
+        }
+    }
+    uint64_t hash = rotate(lanes[0], 1) + rotate(lanes[1], 7)
+        + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+    for (; end - bytes >= 8; bytes += 8) {
+        hash = rotate(hash ^ (load(bytes) * PRIME_2), 27) * PRIME_1;
+    }
+    for (; bytes < end; ++bytes) {
+        hash = rotate(hash ^ (*bytes * PRIME_1), 11) * PRIME_2;
+    }
+    return mix(hash ^ size);
+}
+
+/* The executable itself identifies the build, so an entry is never used by
+   an assembler that could write something else for the same input, no
+   matter which part of it changed. */
+bool cache_init(cache_t *cache, const char *directory)
+{
+    cache->directory = directory;
+    cache->build = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    if (directory == NULL) {
+        return true;
+    }
+
+    int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat stat;
+    if (fstat(fd, &stat) == -1) {
+        goto close_fd;
+    }
+    void *map = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        goto close_fd;
+    }
+    cache->build = hash_bytes(map, stat.st_size, CACHE_VERSION);
+    munmap(map, stat.st_size);
+    close(fd);
+    return true;
+
+ close_fd:
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+    }
+    return false;
+}
+
+uint64_t cache_key(const cache_t *cache, const void *input, size_t size,
+                   uint64_t options)
+{
+    return hash_bytes(input, size, cache->build + options * PRIME_1);
+}
+
+static void entry_path(const cache_t *cache, uint64_t key, char *path,
+                       size_t path_size)
+{
+    snprintf(path, path_size, "%s/%016" PRIx64, cache->directory, key);
+}
+
+/* checks that the entry was written for this input and that the output
+   file is all there */
+static bool is_entry_valid(const cache_header_t *header, size_t map_size,
+                           uint64_t key, uint64_t input_size)
+{
+    if (map_size < sizeof(*header)
+        || memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+        || header->version != CACHE_VERSION || header->key != key
+        || header->input_size != input_size) {
+        return false;
+    }
+    return header->output_size == map_size - sizeof(*header);
+}
+
+bool cache_lookup(cache_t *cache, uint64_t key, uint64_t input_size,
+                  cache_entry_t *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    char path[4096];
+    entry_path(cache, key, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        goto miss;
+    }
+    struct stat stat;
+    if (fstat(fd, &stat) == -1 || stat.st_size == 0) {
+        goto close_fd;
+    }
+    void *map = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        goto close_fd;
+    }
+    const cache_header_t *header = map;
+    if (!is_entry_valid(header, stat.st_size, key, input_size)) {
+        munmap(map, stat.st_size);
+        goto close_fd;
+    }
+    close(fd);
+
+    entry->map = map;
+    entry->map_size = stat.st_size;
+    entry->output = (const uint8_t *) (header + 1);
+    entry->output_size = header->output_size;
+    ++cache->hits;
+    return true;
+
+ close_fd:
+    close(fd);
+ miss:
+    ++cache->misses;
+    return false;
+}
+
+void cache_entry_fini(cache_entry_t *entry)
+{
+    if (entry->map != NULL) {
+        munmap(entry->map, entry->map_size);
+    }
+    memset(entry, 0, sizeof(*entry));
+}
+
+bool cache_store(cache_t *cache, uint64_t key, uint64_t input_size,
+                 const struct iovec *iov, size_t iov_size)
+{
+    cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.input_size = input_size;
+    for (size_t i = 0; i < iov_size; ++i) {
+        header.output_size += iov[i].iov_len;
+    }
+
+    /* written under a temporary name and renamed so concurrent builds never
+       see a partial entry */
+    char path[4096];
+    char temporary_path[sizeof(path) + 8];
+    entry_path(cache, key, path, sizeof(path));
+    snprintf(temporary_path, sizeof(temporary_path), "%s.XXXXXX", path);
+    if (mkdir(cache->directory, 0755) == -1 && errno != EEXIST) {
+        return false;
+    }
+    int fd = mkstemp(temporary_path);
+    if (fd == -1) {
+        return false;
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (file == NULL) {
+        close(fd);
+        goto unlink_temporary;
+    }
+    fchmod(fd, 0644);
+
+    fwrite(&header, sizeof(header), 1, file);
+    for (size_t i = 0; i < iov_size; ++i) {
+        fwrite(iov[i].iov_base, 1, iov[i].iov_len, file);
+    }
+    bool is_written = !ferror(file);
+    if (fclose(file) != 0 || !is_written) {
+        goto unlink_temporary;
+    }
+    if (rename(temporary_path, path) == -1) {
+        goto unlink_temporary;
+    }
+    return true;
+
+ unlink_temporary:
+    {
+        int error = errno;
+        unlink(temporary_path);
+        errno = error;
+    }
+    return false;
+}
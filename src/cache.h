@@ -0,0 +1,72 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef EYL_CACHE_H
+#define EYL_CACHE_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* POSIX */
+#include <sys/uio.h>
+
+/* bump whenever the format of an entry changes, entries written in other
+   formats are then never read; a change to what the assembler writes
+   needs no bump, every build of it has its own keys */
+#define CACHE_VERSION 5
+
+/* Entries are files in the directory named by the hash of the input, each
+   holding the whole output file, symbols included. */
+typedef struct {
+    const char *directory;
+    uint64_t build; /* the hash of the running assembler */
+    uint64_t hits;
+    uint64_t misses;
+} cache_t;
+
+/* a mapped entry, the pointers are valid until cache_entry_fini */
+typedef struct {
+    void *map;
+    size_t map_size;
+    const uint8_t *output;
+    uint64_t output_size;
+} cache_entry_t;
+
+/* hashes the running executable unless directory is NULL, for a cache that
+   only counts, returns false and sets errno if it cannot be read */
+bool cache_init(cache_t *cache, const char *directory);
+
+/* returns the key of the input for this build of the assembler, options
+   holds anything else that changes the output */
+uint64_t cache_key(const cache_t *cache, const void *input, size_t size,
+                   uint64_t options);
+
+/* maps the entry for key, counting a hit if it exists and is intact and a
+   miss otherwise, returns whether it was found */
+bool cache_lookup(cache_t *cache, uint64_t key, uint64_t input_size,
+                  cache_entry_t *entry);
+void cache_entry_fini(cache_entry_t *entry);
+
+/* stores the output file described by iov as the entry for key, replacing
+   any previous entry atomically, returns false and sets errno if it could
+   not be written */
+bool cache_store(cache_t *cache, uint64_t key, uint64_t input_size,
+                 const struct iovec *iov, size_t iov_size);
+
+#endif
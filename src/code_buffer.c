@@ -0,0 +1,83 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "code_buffer.h"
+
+/* C */
+#include <stdlib.h>
+#include <string.h>
+
+void code_buffer_init(code_buffer_t *buffer)
+{
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void code_buffer_fini(code_buffer_t *buffer)
+{
+    code_chunk_t *chunk = buffer->head;
+    while (chunk != NULL) {
+        code_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void code_buffer_clear(code_buffer_t *buffer)
+{
+    code_chunk_t *head = buffer->head;
+    if (head == NULL) {
+        return;
+    }
+    code_chunk_t *chunk = head->next;
+    while (chunk != NULL) {
+        code_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    head->next = NULL;
+    head->size = 0;
+    buffer->tail = head;
+    buffer->size = 0;
+}
+
+uint8_t *code_buffer_append(code_buffer_t *buffer, size_t size)
+{
+    code_chunk_t *tail = buffer->tail;
+    if (tail == NULL || tail->capacity - tail->size < size) {
+        size_t capacity = size > CODE_CHUNK_CAPACITY ? size
+                                                     : CODE_CHUNK_CAPACITY;
+        code_chunk_t *chunk = malloc(sizeof(*chunk) + capacity);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = NULL;
+        chunk->size = 0;
+        chunk->capacity = capacity;
+        if (tail == NULL) {
+            buffer->head = chunk;
+        }
+        else {
+            tail->next = chunk;
+        }
+        buffer->tail = chunk;
+        tail = chunk;
+    }
+    uint8_t *bytes = tail->bytes + tail->size;
+    tail->size += size;
+    buffer->size += size;
+    return bytes;
+}
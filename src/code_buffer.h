@@ -0,0 +1,54 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_CODE_BUFFER_H
+#define EYL_CODE_BUFFER_H
+
+/* C */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Emitted machine code is kept in a list of large chunks. When a chunk is full
+   a new one is started, so bytes never move once they are written and
+   pointers into them stay valid while more code is appended. */
+
+#define CODE_CHUNK_CAPACITY (1 << 20)
+
+typedef struct code_chunk {
+    struct code_chunk *next;
+    size_t size;
+    size_t capacity;
+    uint8_t bytes[];
+} code_chunk_t;
+
+typedef struct {
+    code_chunk_t *head;
+    code_chunk_t *tail;
+    size_t size;
+} code_buffer_t;
+
+void code_buffer_init(code_buffer_t *buffer);
+void code_buffer_fini(code_buffer_t *buffer);
+
+/* empties the buffer but keeps its first chunk, so refilling it with a small
+   amount of code does not allocate */
+void code_buffer_clear(code_buffer_t *buffer);
+
+/* returns space for size contiguous bytes at the end of the buffer, or NULL if
+   a new chunk could not be allocated */
+uint8_t *code_buffer_append(code_buffer_t *buffer, size_t size);
+
+#endif
@@ -0,0 +1,355 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#define _XOPEN_SOURCE 700
+
+#include "builder.h"
+
+/* C */
+#include <errno.h>
+#include <string.h>
+
+/* POSIX */
+#include <limits.h>
+#include <unistd.h>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    if (alignment <= 1) {
+        return value;
+    }
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void elf_builder_init(elf_builder_t *elf, uint16_t type,
+                      uint64_t base_address)
+{
+    memset(elf, 0, sizeof(*elf));
+    elf->type = type;
+    elf->base_address = base_address;
+    elf->sections_size = 1;
+    elf->sections[0].name = "";
+    elf->sections[0].segment = ELF_NO_SEGMENT;
+}
+
+size_t elf_builder_add_segment(elf_builder_t *elf, uint32_t flags,
+                               uint64_t alignment)
+{
+    if (elf->segments_size == ELF_SEGMENTS_CAPACITY) {
+        return ELF_NO_SEGMENT;
+    }
+    elf_segment_t *segment = &elf->segments[elf->segments_size];
+    memset(segment, 0, sizeof(*segment));
+    segment->flags = flags;
+    segment->alignment = alignment < ELF_PAGE_SIZE ? ELF_PAGE_SIZE
+                                                   : alignment;
+    return elf->segments_size++;
+}
+
+size_t elf_builder_add_section(elf_builder_t *elf, const char *name,
+                               uint32_t type, uint64_t flags,
+                               uint64_t alignment, uint64_t size,
+                               size_t segment)
+{
+    if (elf->sections_size == ELF_SECTIONS_CAPACITY) {
+        return ELF_NO_SECTION;
+    }
+    elf_section_t *section = &elf->sections[elf->sections_size];
+    memset(section, 0, sizeof(*section));
+    section->name = name;
+    section->type = type;
+    section->flags = flags;
+    section->alignment = alignment == 0 ? 1 : alignment;
+    section->size = size;
+    section->segment = segment;
+    return elf->sections_size++;
+}
+
+/* returns true if suffix is the end of name */
+static bool is_suffix(const char *name, size_t name_size,
+                      const char *suffix, size_t suffix_size)
+{
+    return suffix_size <= name_size
+        && memcmp(name + (name_size - suffix_size), suffix, suffix_size) == 0;
+}
+
+/* Every name is either written out or shares the end of the longest name
+   it is a suffix of (the first one of that length), which is always
+   written out, so .text is the end of .rela.text. */
+static void lay_out_names(elf_builder_t *elf, const char *names_name)
+{
+    size_t sizes[ELF_SECTIONS_CAPACITY + 1];
+    const char *names[ELF_SECTIONS_CAPACITY + 1];
+    size_t names_size = elf->sections_size;
+    for (size_t i = 0; i < elf->sections_size; ++i) {
+        names[i] = elf->sections[i].name;
+        sizes[i] = strlen(names[i]);
+    }
+    names[names_size] = names_name;
+    sizes[names_size] = strlen(names_name);
+    ++names_size;
+
+    uint32_t offsets[ELF_SECTIONS_CAPACITY + 1];
+    size_t owners[ELF_SECTIONS_CAPACITY + 1];
+    uint64_t size = 1; /* the empty name */
+    for (size_t i = 0; i < names_size; ++i) {
+        owners[i] = i;
+        for (size_t j = 0; j < names_size; ++j) {
+            size_t owner = owners[i];
+            if (j != i
+                && (sizes[j] > sizes[owner]
+                    || (sizes[j] == sizes[owner] && j < owner))
+                && is_suffix(names[j], sizes[j], names[i], sizes[i])) {
+                owners[i] = j;
+            }
+        }
+        if (sizes[i] == 0) {
+            offsets[i] = 0;
+        }
+        else if (owners[i] == i) {
+            offsets[i] = size;
+            size += sizes[i] + 1;
+        }
+    }
+    for (size_t i = 0; i < names_size; ++i) {
+        size_t owner = owners[i];
+        if (sizes[i] != 0 && owner != i) {
+            offsets[i] = offsets[owner] + (sizes[owner] - sizes[i]);
+        }
+    }
+    for (size_t i = 0; i < elf->sections_size; ++i) {
+        elf->sections[i].name_offset = offsets[i];
+    }
+    elf->names_name_offset = offsets[elf->sections_size];
+    elf->names_size = size;
+}
+
+/* places the section at the first offset after offset that is a multiple
+   of its alignment, returns where the next one may start, which is offset
+   again if it takes no room in the file */
+static uint64_t place_unloaded(elf_section_t *section, uint64_t offset)
+{
+    section->offset = align_up(offset, section->alignment);
+    section->address = 0;
+    if (section->type == SHT_NOBITS) {
+        return offset;
+    }
+    return section->offset + section->size;
+}
+
+/* A section that is not in the file, like .bss, must be the last one in
+   its segment. Its offset is where it would be. */
+void elf_builder_layout(elf_builder_t *elf)
+{
+    elf->headers_size = sizeof(Elf64_Ehdr)
+        + elf->segments_size * sizeof(Elf64_Phdr);
+    uint64_t offset = elf->headers_size;
+    uint64_t address = elf->base_address + offset;
+    uint64_t alignment = 0;
+    for (size_t g = 0; g < elf->segments_size; ++g) {
+        elf_segment_t *segment = &elf->segments[g];
+        if (g == 0) {
+            segment->offset = 0;
+            segment->address = elf->base_address;
+        }
+        else {
+            /* the file and memory offsets into a page must match */
+            segment->offset = align_up(offset, ELF_PAGE_SIZE);
+            segment->address = align_up(address,
+                                        alignment > segment->alignment
+                                        ? alignment : segment->alignment);
+            offset = segment->offset;
+            address = segment->address;
+        }
+        for (size_t i = 1; i < elf->sections_size; ++i) {
+            elf_section_t *section = &elf->sections[i];
+            if (section->segment != g) {
+                continue;
+            }
+            uint64_t start = align_up(address, section->alignment);
+            section->address = start;
+            if (section->type == SHT_NOBITS) {
+                section->offset = offset;
+                address = start + section->size;
+                continue;
+            }
+            section->offset = offset + (start - address);
+            offset = section->offset + section->size;
+            address = start + section->size;
+        }
+        segment->file_size = offset - segment->offset;
+        segment->memory_size = address - segment->address;
+        alignment = segment->alignment;
+    }
+    elf->loaded_size = offset;
+
+    for (size_t i = 1; i < elf->sections_size; ++i) {
+        elf_section_t *section = &elf->sections[i];
+        if (section->segment == ELF_NO_SEGMENT) {
+            offset = place_unloaded(section, offset);
+        }
+    }
+    if (elf->is_stripped) {
+        elf->names_offset = 0;
+        elf->names_size = 0;
+        elf->names_name_offset = 0;
+        elf->section_headers_offset = 0;
+        elf->file_size = offset;
+        return;
+    }
+    lay_out_names(elf, ".shstrtab");
+    elf->names_offset = offset;
+    elf->section_headers_offset = align_up(offset + elf->names_size, 8);
+    elf->file_size = elf->section_headers_offset
+        + (elf->sections_size + 1) * sizeof(Elf64_Shdr);
+}
+
+/* zeros the bytes from *offset up to end and moves *offset there */
+static void pad(uint8_t *bytes, uint64_t *offset, uint64_t end)
+{
+    if (end > *offset) {
+        memset(bytes + *offset, 0, end - *offset);
+        *offset = end;
+    }
+}
+
+static void write_section_header(Elf64_Shdr *header,
+                                 const elf_section_t *section)
+{
+    header->sh_name = section->name_offset;
+    header->sh_type = section->type;
+    header->sh_flags = section->flags;
+    header->sh_addr = section->address;
+    header->sh_offset = section->offset;
+    header->sh_size = section->size;
+    header->sh_link = section->link;
+    header->sh_info = section->info;
+    header->sh_addralign = section->alignment;
+    header->sh_entsize = section->entry_size;
+}
+
+/* The sections are written in the order they are in the file, which is
+   the order they were added in. */
+void elf_builder_write(const elf_builder_t *elf, uint8_t *bytes)
+{
+    Elf64_Ehdr *header = (Elf64_Ehdr *) bytes;
+    memset(header, 0, sizeof(*header));
+    header->e_ident[EI_MAG0] = ELFMAG0;
+    header->e_ident[EI_MAG1] = ELFMAG1;
+    header->e_ident[EI_MAG2] = ELFMAG2;
+    header->e_ident[EI_MAG3] = ELFMAG3;
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_type = elf->type;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_entry = elf->entry;
+    header->e_phoff = elf->segments_size != 0 ? sizeof(Elf64_Ehdr) : 0;
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+    header->e_phentsize = sizeof(Elf64_Phdr);
+    header->e_phnum = elf->segments_size;
+    header->e_shentsize = sizeof(Elf64_Shdr);
+    if (!elf->is_stripped) {
+        header->e_shoff = elf->section_headers_offset;
+        header->e_shnum = elf->sections_size + 1;
+        header->e_shstrndx = elf->sections_size;
+    }
+
+    Elf64_Phdr *program_headers = (Elf64_Phdr *) (bytes + sizeof(*header));
+    for (size_t g = 0; g < elf->segments_size; ++g) {
+        const elf_segment_t *segment = &elf->segments[g];
+        Elf64_Phdr *program_header = &program_headers[g];
+        program_header->p_type = PT_LOAD;
+        program_header->p_flags = segment->flags;
+        program_header->p_offset = segment->offset;
+        program_header->p_vaddr = segment->address;
+        program_header->p_paddr = segment->address;
+        program_header->p_filesz = segment->file_size;
+        program_header->p_memsz = segment->memory_size;
+        program_header->p_align = segment->alignment;
+    }
+
+    uint64_t offset = elf->headers_size;
+    for (size_t i = 1; i < elf->sections_size; ++i) {
+        const elf_section_t *section = &elf->sections[i];
+        if (section->type == SHT_NOBITS) {
+            continue;
+        }
+        pad(bytes, &offset, section->offset);
+        if (section->data != NULL) {
+            memcpy(bytes + section->offset, section->data, section->size);
+        }
+        offset = section->offset + section->size;
+    }
+    if (elf->is_stripped) {
+        pad(bytes, &offset, elf->file_size);
+        return;
+    }
+
+    /* a name that is the end of another is written again with it */
+    pad(bytes, &offset, elf->names_offset);
+    char *names = (char *) bytes + elf->names_offset;
+    memset(names, 0, elf->names_size);
+    for (size_t i = 1; i < elf->sections_size; ++i) {
+        const elf_section_t *section = &elf->sections[i];
+        memcpy(names + section->name_offset, section->name,
+               strlen(section->name));
+    }
+    memcpy(names + elf->names_name_offset, ".shstrtab", 9);
+    offset = elf->names_offset + elf->names_size;
+    pad(bytes, &offset, elf->section_headers_offset);
+
+    Elf64_Shdr *section_headers =
+        (Elf64_Shdr *) (bytes + elf->section_headers_offset);
+    memset(section_headers, 0, sizeof(*section_headers));
+    for (size_t i = 1; i < elf->sections_size; ++i) {
+        write_section_header(&section_headers[i], &elf->sections[i]);
+    }
+    elf_section_t names_section = {
+        .type = SHT_STRTAB,
+        .alignment = 1,
+        .size = elf->names_size,
+        .offset = elf->names_offset,
+        .name_offset = elf->names_name_offset
+    };
+    write_section_header(&section_headers[elf->sections_size],
+                         &names_section);
+}
+
+bool elf_write_all(int fd, struct iovec *iov, size_t iov_size)
+{
+    while (iov_size > 0) {
+        int batch_size = iov_size < IOV_MAX ? iov_size : IOV_MAX;
+        ssize_t written = writev(fd, iov, batch_size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (iov_size > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --iov_size;
+        }
+        if (iov_size > 0) {
+            iov->iov_base = (uint8_t *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
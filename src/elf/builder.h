@@ -0,0 +1,154 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_ELF_BUILDER_H
+#define EYL_ELF_BUILDER_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* POSIX */
+#include <sys/uio.h>
+
+/* ELF */
+#include <elf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Builds a 64-bit x86-64 ELF file from sections and the segments that load
+   them, computing every offset, address and size. A builder is plain data
+   without allocations, so it can be copied to add more sections to a file
+   that was already laid out. Usage:
+
+       elf_builder_t elf;
+       elf_builder_init(&elf, ET_EXEC, 0x400000);
+       size_t text = elf_builder_add_segment(&elf, PF_R | PF_X, 4096);
+       size_t code = elf_builder_add_section(&elf, ".text", SHT_PROGBITS,
+                                             SHF_ALLOC | SHF_EXECINSTR,
+                                             16, size, text);
+       elf.sections[code].data = machine_code;
+       elf_builder_layout(&elf);
+       elf.entry = elf.sections[code].address;
+       ... a buffer of elf.file_size bytes ...
+       elf_builder_write(&elf, buffer);
+
+   Sections are placed in the order they are added, the ones in a segment
+   must come first, in the order of their segments. The first segment also
+   maps the ELF and program headers, each later one starts on a new page in
+   the file and in memory at or after its alignment. Sections in no segment
+   follow everything that is loaded and the section header table comes
+   last, after the .shstrtab the builder adds itself.
+
+   A builder holds at most ELF_SEGMENTS_CAPACITY segments and
+   ELF_SECTIONS_CAPACITY - 1 sections besides the null one and .shstrtab,
+   adding one more fails and returns ELF_NO_SEGMENT or ELF_NO_SECTION. */
+
+#define ELF_SECTIONS_CAPACITY 16
+#define ELF_SEGMENTS_CAPACITY 4
+#define ELF_NO_SEGMENT SIZE_MAX
+#define ELF_NO_SECTION SIZE_MAX
+#define ELF_PAGE_SIZE 4096
+
+typedef struct {
+    const char *name; /* not copied */
+    uint32_t type;    /* SHT_ */
+    uint64_t flags;   /* SHF_ */
+    uint64_t alignment;
+    uint64_t size;
+    uint64_t entry_size;
+    uint32_t link;
+    uint32_t info;
+    size_t segment;   /* ELF_NO_SEGMENT if it is not loaded */
+    /* written by elf_builder_write unless NULL, then the caller fills the
+       section in the buffer */
+    const void *data;
+
+    /* set by elf_builder_layout */
+    uint64_t offset;
+    uint64_t address;
+    uint32_t name_offset;
+} elf_section_t;
+
+typedef struct {
+    uint32_t flags;   /* PF_ */
+    uint64_t alignment;
+
+    /* set by elf_builder_layout */
+    uint64_t offset;
+    uint64_t address;
+    uint64_t file_size;
+    uint64_t memory_size;
+} elf_segment_t;
+
+typedef struct {
+    uint16_t type; /* ET_EXEC or ET_REL */
+    uint64_t base_address; /* of the first segment */
+    uint64_t entry;
+    /* no section headers are written, only what a loader needs */
+    bool is_stripped;
+
+    elf_section_t sections[ELF_SECTIONS_CAPACITY]; /* the first is null */
+    size_t sections_size;
+    elf_segment_t segments[ELF_SEGMENTS_CAPACITY];
+    size_t segments_size;
+
+    /* set by elf_builder_layout */
+    uint64_t headers_size; /* the ELF header and the program headers */
+    uint64_t loaded_size; /* the end of the last section in a segment */
+    uint64_t names_offset; /* of .shstrtab, the last section header */
+    uint64_t names_size;
+    uint32_t names_name_offset;
+    uint64_t section_headers_offset;
+    uint64_t file_size;
+} elf_builder_t;
+
+void elf_builder_init(elf_builder_t *elf, uint16_t type,
+                      uint64_t base_address);
+
+/* returns the index of the new segment, or ELF_NO_SEGMENT if there is no
+   room for it */
+size_t elf_builder_add_segment(elf_builder_t *elf, uint32_t flags,
+                               uint64_t alignment);
+
+/* returns the index of the new section, in the section headers too, or
+   ELF_NO_SECTION if there is no room for it */
+size_t elf_builder_add_section(elf_builder_t *elf, const char *name,
+                               uint32_t type, uint64_t flags,
+                               uint64_t alignment, uint64_t size,
+                               size_t segment);
+
+/* places every section and segment, names that are the end of another name
+   share its bytes in .shstrtab */
+void elf_builder_layout(elf_builder_t *elf);
+
+/* writes the laid out file into bytes, which has room for file_size bytes,
+   in one pass: headers, the data of every section that has it, zeros in
+   between, .shstrtab and the section headers */
+void elf_builder_write(const elf_builder_t *elf, uint8_t *bytes);
+
+/* writes every byte described by iov to fd, resuming after short writes
+   and interrupted calls, iov is modified */
+bool elf_write_all(int fd, struct iovec *iov, size_t iov_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,483 @@
+/*
+ * Copyright 2015 Jonathan Eyolfson
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Prints the layout of an ELF file: its segments, its sections, the bytes
+   of the file that belong to neither (alignment padding) and the sizes of
+   its symbols. The file is mapped and every header and table is read in
+   place when it is printed, nothing is parsed up front or copied, so only
+   the pages of the headers are touched unless symbols are asked for. */
+
+#include <elf.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+/* how many of the largest symbols are printed */
+#define LARGEST_SYMBOLS_SIZE 10
+
+/* a mapped 64-bit little endian ELF file */
+struct elf_file {
+    const uint8_t *bytes;
+    uint64_t size;
+    const Elf64_Ehdr *header;
+};
+
+/* returns true if size bytes at offset are in the file */
+static bool is_in_file(const elf_file &file, uint64_t offset, uint64_t size)
+{
+    return offset <= file.size && size <= file.size - offset;
+}
+
+/* returns true if the program and section header tables are whole */
+static bool are_tables_in_file(const elf_file &file)
+{
+    const Elf64_Ehdr *header = file.header;
+    return is_in_file(file, header->e_phoff,
+                      uint64_t(header->e_phnum) * header->e_phentsize)
+        && is_in_file(file, header->e_shoff,
+                      uint64_t(header->e_shnum) * header->e_shentsize);
+}
+
+static const Elf64_Phdr *program_header(const elf_file &file, size_t i)
+{
+    const Elf64_Ehdr *header = file.header;
+    uint64_t offset = header->e_phoff + i * header->e_phentsize;
+    if (i >= header->e_phnum || header->e_phentsize < sizeof(Elf64_Phdr)
+        || !is_in_file(file, offset, sizeof(Elf64_Phdr))) {
+        return nullptr;
+    }
+    return reinterpret_cast<const Elf64_Phdr *>(file.bytes + offset);
+}
+
+static const Elf64_Shdr *section_header(const elf_file &file, size_t i)
+{
+    const Elf64_Ehdr *header = file.header;
+    uint64_t offset = header->e_shoff + i * header->e_shentsize;
+    if (i >= header->e_shnum || header->e_shentsize < sizeof(Elf64_Shdr)
+        || !is_in_file(file, offset, sizeof(Elf64_Shdr))) {
+        return nullptr;
+    }
+    return reinterpret_cast<const Elf64_Shdr *>(file.bytes + offset);
+}
+
+/* returns the string at offset in the string table section, or "?" if it
+   is not a terminated string in the file */
+static const char *string(const elf_file &file, size_t table,
+                          uint64_t offset)
+{
+    const Elf64_Shdr *strings = section_header(file, table);
+    if (strings == nullptr || strings->sh_type != SHT_STRTAB
+        || offset >= strings->sh_size
+        || !is_in_file(file, strings->sh_offset, strings->sh_size)) {
+        return "?";
+    }
+    const char *start = reinterpret_cast<const char *>(file.bytes)
+        + strings->sh_offset + offset;
+    if (memchr(start, '\0', strings->sh_size - offset) == nullptr) {
+        return "?";
+    }
+    return start;
+}
+
+static const char *section_name(const elf_file &file,
+                                const Elf64_Shdr *section)
+{
+    return string(file, file.header->e_shstrndx, section->sh_name);
+}
+
+static const char *section_type(uint32_t type)
+{
+    switch (type) {
+    case SHT_NULL: return "NULL";
+    case SHT_PROGBITS: return "PROGBITS";
+    case SHT_SYMTAB: return "SYMTAB";
+    case SHT_STRTAB: return "STRTAB";
+    case SHT_RELA: return "RELA";
+    case SHT_HASH: return "HASH";
+    case SHT_DYNAMIC: return "DYNAMIC";
+    case SHT_NOTE: return "NOTE";
+    case SHT_NOBITS: return "NOBITS";
+    case SHT_REL: return "REL";
+    case SHT_DYNSYM: return "DYNSYM";
+    case SHT_INIT_ARRAY: return "INIT_ARRAY";
+    case SHT_FINI_ARRAY: return "FINI_ARRAY";
+    default: return "OTHER";
+    }
+}
+
+/* maps the file read only, returns false if it is not a 64-bit little
+   endian ELF file */
+static bool map_file(elf_file *file, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("opening file");
+        return false;
+    }
+    struct stat stat;
+    if (fstat(fd, &stat) == -1) {
+        perror("stating file");
+        close(fd);
+        return false;
+    }
+    file->size = stat.st_size;
+    if (file->size < sizeof(Elf64_Ehdr)) {
+        fprintf(stderr, "%s: too small for an ELF header\n", path);
+        close(fd);
+        return false;
+    }
+    void *bytes = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (bytes == MAP_FAILED) {
+        perror("mmap file");
+        return false;
+    }
+    /* headers and tables are read here and there, read ahead is wasted */
+    madvise(bytes, file->size, MADV_RANDOM);
+    file->bytes = static_cast<const uint8_t *>(bytes);
+    file->header = reinterpret_cast<const Elf64_Ehdr *>(bytes);
+    const unsigned char *ident = file->header->e_ident;
+    if (memcmp(ident, ELFMAG, SELFMAG) != 0 || ident[EI_CLASS] != ELFCLASS64
+        || ident[EI_DATA] != ELFDATA2LSB) {
+        fprintf(stderr, "%s: not a 64-bit little endian ELF file\n", path);
+        munmap(bytes, file->size);
+        return false;
+    }
+    return true;
+}
+
+static void print_segments(const elf_file &file)
+{
+    printf("\nsegments\n");
+    printf("  %-3s %-8s %-4s %18s %18s %18s %18s %10s\n", "nr", "type",
+           "flg", "offset", "file size", "address", "memory size", "align");
+    for (size_t i = 0; i < file.header->e_phnum; ++i) {
+        const Elf64_Phdr *segment = program_header(file, i);
+        if (segment == nullptr) {
+            printf("  [%zu] outside of the file\n", i);
+            break;
+        }
+        const char *type = segment->p_type == PT_LOAD ? "LOAD" : "OTHER";
+        printf("  %-3zu %-8s %c%c%c  %#18" PRIx64 " %#18" PRIx64 " %#18"
+               PRIx64 " %#18" PRIx64 " %#10" PRIx64 "\n", i, type,
+               segment->p_flags & PF_R ? 'R' : '-',
+               segment->p_flags & PF_W ? 'W' : '-',
+               segment->p_flags & PF_X ? 'X' : '-',
+               segment->p_offset, segment->p_filesz, segment->p_vaddr,
+               segment->p_memsz, segment->p_align);
+    }
+}
+
+static void print_sections(const elf_file &file)
+{
+    printf("\nsections\n");
+    printf("  %-3s %-16s %-10s %-3s %18s %18s %18s %6s\n", "nr", "name",
+           "type", "flg", "offset", "size", "address", "align");
+    for (size_t i = 1; i < file.header->e_shnum; ++i) {
+        const Elf64_Shdr *section = section_header(file, i);
+        if (section == nullptr) {
+            printf("  [%zu] outside of the file\n", i);
+            break;
+        }
+        printf("  %-3zu %-16s %-10s %c%c%c %#18" PRIx64 " %#18" PRIx64
+               " %#18" PRIx64 " %6" PRIu64 "\n", i,
+               section_name(file, section), section_type(section->sh_type),
+               section->sh_flags & SHF_ALLOC ? 'A' : '-',
+               section->sh_flags & SHF_WRITE ? 'W' : '-',
+               section->sh_flags & SHF_EXECINSTR ? 'X' : '-',
+               section->sh_offset, section->sh_size, section->sh_addr,
+               section->sh_addralign);
+    }
+}
+
+/* a part of the file that something describes */
+struct extent {
+    uint64_t offset;
+    uint64_t size;
+    const char *name;
+};
+
+/* adds the part of the extent that is in the file */
+static void add_extent(std::vector<extent> &extents, const elf_file &file,
+                       uint64_t offset, uint64_t size, const char *name)
+{
+    if (offset >= file.size || size == 0) {
+        return;
+    }
+    if (size > file.size - offset) {
+        size = file.size - offset;
+    }
+    extents.push_back({ offset, size, name });
+}
+
+/* Every byte of the file that is not in the headers, the header tables or
+   a section is padding, which is mostly what aligning segments to pages
+   and sections to their alignment costs. The padding in memory is what
+   aligning the sections of each segment costs in its address range. A
+   file without section headers only has its segments to go by. */
+static void print_padding(const elf_file &file)
+{
+    const Elf64_Ehdr *header = file.header;
+    std::vector<extent> extents;
+    add_extent(extents, file, 0, sizeof(Elf64_Ehdr), "ELF header");
+    add_extent(extents, file, header->e_phoff,
+               uint64_t(header->e_phnum) * header->e_phentsize,
+               "program headers");
+    add_extent(extents, file, header->e_shoff,
+               uint64_t(header->e_shnum) * header->e_shentsize,
+               "section headers");
+    for (size_t i = 1; i < header->e_shnum; ++i) {
+        const Elf64_Shdr *section = section_header(file, i);
+        if (section == nullptr) {
+            break;
+        }
+        if (section->sh_type != SHT_NOBITS) {
+            add_extent(extents, file, section->sh_offset, section->sh_size,
+                       section_name(file, section));
+        }
+    }
+    for (size_t p = 0; header->e_shnum == 0 && p < header->e_phnum; ++p) {
+        const Elf64_Phdr *segment = program_header(file, p);
+        if (segment == nullptr) {
+            break;
+        }
+        if (segment->p_type == PT_LOAD) {
+            add_extent(extents, file, segment->p_offset, segment->p_filesz,
+                       "a segment");
+        }
+    }
+    std::sort(extents.begin(), extents.end(),
+              [](const extent &a, const extent &b) {
+                  return a.offset < b.offset;
+              });
+
+    printf("\npadding\n");
+    uint64_t end = 0;
+    const char *before = "start of file";
+    uint64_t file_padding = 0;
+    for (const extent &e : extents) {
+        if (e.offset > end) {
+            printf("  %10" PRIu64 " bytes in the file after %s\n",
+                   e.offset - end, before);
+            file_padding += e.offset - end;
+        }
+        if (e.offset + e.size > end) {
+            end = e.offset + e.size;
+            before = e.name;
+        }
+    }
+    if (file.size > end) {
+        printf("  %10" PRIu64 " bytes in the file after %s\n",
+               file.size - end, before);
+        file_padding += file.size - end;
+    }
+    printf("  %10" PRIu64 " bytes of %" PRIu64 " in the file (%.2f%%)\n",
+           file_padding, file.size, 100.0 * file_padding / file.size);
+
+    for (size_t p = 0; header->e_shnum != 0 && p < header->e_phnum; ++p) {
+        const Elf64_Phdr *segment = program_header(file, p);
+        if (segment == nullptr) {
+            break;
+        }
+        if (segment->p_type != PT_LOAD) {
+            continue;
+        }
+        uint64_t used = 0;
+        for (size_t i = 1; i < header->e_shnum; ++i) {
+            const Elf64_Shdr *section = section_header(file, i);
+            if (section == nullptr) {
+                break;
+            }
+            if ((section->sh_flags & SHF_ALLOC)
+                && section->sh_addr >= segment->p_vaddr
+                && section->sh_addr + section->sh_size
+                   <= segment->p_vaddr + segment->p_memsz) {
+                used += section->sh_size;
+            }
+        }
+        /* the first segment usually maps the headers too */
+        if (segment->p_offset == 0 && segment->p_filesz != 0) {
+            used += sizeof(Elf64_Ehdr)
+                + uint64_t(header->e_phnum) * header->e_phentsize;
+        }
+        if (used < segment->p_memsz) {
+            printf("  %10" PRIu64 " bytes in memory in segment %zu\n",
+                   segment->p_memsz - used, p);
+        }
+    }
+}
+
+/* a symbol with a size, only kept while finding the largest ones */
+struct sized_symbol {
+    uint64_t size;
+    size_t index;
+};
+
+/* Prints how much of each section its symbols cover and the largest
+   symbols, or every symbol with is_listed. The table is walked once and
+   only the largest symbols are kept. */
+static void print_symbols(const elf_file &file, bool is_listed)
+{
+    const Elf64_Ehdr *header = file.header;
+    const Elf64_Shdr *table = nullptr;
+    for (size_t i = 1; i < header->e_shnum; ++i) {
+        const Elf64_Shdr *section = section_header(file, i);
+        if (section == nullptr) {
+            break;
+        }
+        if (section->sh_type == SHT_SYMTAB
+            || (section->sh_type == SHT_DYNSYM && table == nullptr)) {
+            table = section;
+        }
+    }
+    printf("\nsymbols\n");
+    if (table == nullptr || table->sh_entsize < sizeof(Elf64_Sym)
+        || !is_in_file(file, table->sh_offset, table->sh_size)) {
+        printf("  no symbol table\n");
+        return;
+    }
+
+    size_t symbols_size = table->sh_size / table->sh_entsize;
+    std::vector<uint64_t> section_sizes(header->e_shnum, 0);
+    std::vector<sized_symbol> largest;
+    uint64_t total = 0;
+    if (is_listed) {
+        printf("  %-8s %18s %12s %5s name\n", "nr", "value", "size",
+               "shndx");
+    }
+    for (size_t i = 1; i < symbols_size; ++i) {
+        const Elf64_Sym *symbol = reinterpret_cast<const Elf64_Sym *>(
+            file.bytes + table->sh_offset + i * table->sh_entsize);
+        if (is_listed) {
+            printf("  %-8zu %#18" PRIx64 " %12" PRIu64 " %5u %s\n", i,
+                   symbol->st_value, symbol->st_size, symbol->st_shndx,
+                   string(file, table->sh_link, symbol->st_name));
+        }
+        if (symbol->st_size == 0) {
+            continue;
+        }
+        total += symbol->st_size;
+        if (symbol->st_shndx < section_sizes.size()) {
+            section_sizes[symbol->st_shndx] += symbol->st_size;
+        }
+        if (largest.size() < LARGEST_SYMBOLS_SIZE
+            || symbol->st_size > largest.back().size) {
+            if (largest.size() == LARGEST_SYMBOLS_SIZE) {
+                largest.pop_back();
+            }
+            sized_symbol sized = { symbol->st_size, i };
+            largest.insert(std::upper_bound(largest.begin(), largest.end(),
+                                            sized,
+                                            [](const sized_symbol &a,
+                                               const sized_symbol &b) {
+                                                return a.size > b.size;
+                                            }),
+                           sized);
+        }
+    }
+
+    printf("  %zu symbols, %" PRIu64 " bytes\n", symbols_size - 1, total);
+    for (size_t i = 1; i < section_sizes.size(); ++i) {
+        const Elf64_Shdr *section = section_header(file, i);
+        if (section == nullptr || section_sizes[i] == 0) {
+            continue;
+        }
+        printf("  %10" PRIu64 " bytes of %" PRIu64 " in %s\n",
+               section_sizes[i], section->sh_size,
+               section_name(file, section));
+    }
+    printf("  largest\n");
+    for (const sized_symbol &sized : largest) {
+        const Elf64_Sym *symbol = reinterpret_cast<const Elf64_Sym *>(
+            file.bytes + table->sh_offset + sized.index * table->sh_entsize);
+        printf("  %10" PRIu64 " %s\n", sized.size,
+               string(file, table->sh_link, symbol->st_name));
+    }
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [--symbols] [--list-symbols] file\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option OPTIONS[] = {
+        { "symbols", no_argument, nullptr, 's' },
+        { "list-symbols", no_argument, nullptr, 'l' },
+        { nullptr, 0, nullptr, 0 }
+    };
+    bool is_symbols = false;
+    bool is_listed = false;
+    int option;
+    while ((option = getopt_long(argc, argv, "", OPTIONS, nullptr)) != -1) {
+        switch (option) {
+        case 's':
+            is_symbols = true;
+            break;
+        case 'l':
+            is_symbols = true;
+            is_listed = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    elf_file file;
+    if (!map_file(&file, argv[optind])) {
+        return 1;
+    }
+    const Elf64_Ehdr *header = file.header;
+    const char *type = header->e_type == ET_EXEC ? "executable"
+        : header->e_type == ET_REL ? "object"
+        : header->e_type == ET_DYN ? "shared object" : "other";
+    printf("%s: %" PRIu64 " bytes, %s, entry %#" PRIx64 "\n", argv[optind],
+           file.size, type, header->e_entry);
+    print_segments(file);
+    if (header->e_shnum != 0) {
+        print_sections(file);
+    }
+    print_padding(file);
+    if (is_symbols) {
+        print_symbols(file, is_listed);
+    }
+    /* what is in the file was printed, but the file is cut short */
+    bool is_whole = are_tables_in_file(file);
+    if (!is_whole) {
+        fprintf(stderr, "%s: the header tables end outside the file\n",
+                argv[optind]);
+    }
+    munmap(const_cast<uint8_t *>(file.bytes), file.size);
+    return is_whole ? 0 : 1;
+}
@@ -15,12 +15,14 @@
  * this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <elf.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "builder.h"
+
 unsigned char instructions[] = {
     0x48, 0xc7, 0xc0, 0x3c, 0x00, 0x00, 0x00, /* mov $0x3c,%rax */
     0x48, 0xc7, 0xc7, 0x2a, 0x00, 0x00, 0x00, /* mov $0x2a,%rdi */
@@ -30,49 +32,44 @@ unsigned char instructions[] = {
 int main(int argc, char **argv)
 {
     mode_t mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-    int fd = open("136-byte-executable", O_WRONLY | O_CREAT, mode);
+    int fd = open("136-byte-executable", O_WRONLY | O_CREAT | O_TRUNC, mode);
     if (fd == -1) {
         printf("failed to open file\n");
+        return 1;
     }
 
-    Elf64_Ehdr header;
-    header.e_ident[EI_MAG0] = ELFMAG0;
-    header.e_ident[EI_MAG1] = ELFMAG1;
-    header.e_ident[EI_MAG2] = ELFMAG2;
-    header.e_ident[EI_MAG3] = ELFMAG3;
-    header.e_ident[EI_CLASS] = ELFCLASS64;
-    header.e_ident[EI_DATA] = ELFDATA2LSB;
-    header.e_ident[EI_VERSION] = EV_CURRENT;
-
-    header.e_type = ET_EXEC;
-    header.e_machine = EM_X86_64;
-    header.e_version = EV_CURRENT;
-    header.e_entry = 0x400000 + 120; /* Entry point virtual address */
-
-    header.e_phoff = 64; /* Program header table file offset */
-    header.e_shoff = 0; /* Section header table file offset */
-
-    header.e_flags = 0; /* Processor-specific flags */
-    header.e_ehsize = 64; /* ELF header size in bytes */
-    header.e_phentsize = 56; /* Program header table entry size */
-    header.e_phnum = 1; /* Program header table entry count */
-    header.e_shentsize = 64; /* Section header table entry size */
-    header.e_shnum = 0; /* Section header table entry count */
-    header.e_shstrndx = 0; /* Section header string table index */
+    /* there is only code, so a single segment maps the headers and it */
+    elf_builder_t elf;
+    elf_builder_init(&elf, ET_EXEC, 0x400000);
+    elf.is_stripped = true;
+    size_t segment = elf_builder_add_segment(&elf, PF_R | PF_X, 4096);
+    size_t text = elf_builder_add_section(&elf, ".text", SHT_PROGBITS,
+                                          SHF_ALLOC | SHF_EXECINSTR, 1,
+                                          sizeof(instructions), segment);
+    if (segment == ELF_NO_SEGMENT || text == ELF_NO_SECTION) {
+        printf("no room for the code\n");
+        close(fd);
+        return 1;
+    }
+    elf.sections[text].data = instructions;
+    elf_builder_layout(&elf);
+    elf.entry = elf.sections[text].address;
 
-    Elf64_Phdr program_header;
-    program_header.p_type = PT_LOAD; /* Segment type */
-    program_header.p_flags = PF_R | PF_X; /* Segment flags */
-    program_header.p_offset = 0; /* Segment file offset */
-    program_header.p_vaddr = 0x400000; /* Segment virtual address */
-    program_header.p_paddr = 0x400000; /* Segment physical address */
-    program_header.p_filesz = 136; /* Segment size in file */
-    program_header.p_memsz = 136; /* Segment size in memory */
-    program_header.p_align = 4096; /* Segment alignment */
+    unsigned char bytes[sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr)
+                        + sizeof(instructions)];
+    if (elf.file_size != sizeof(bytes)) {
+        printf("unexpected file size\n");
+        close(fd);
+        return 1;
+    }
+    elf_builder_write(&elf, bytes);
 
-    write(fd, &header, sizeof(header));
-    write(fd, &program_header, sizeof(program_header));
-    write(fd, instructions, sizeof(instructions));
+    struct iovec iov = { bytes, sizeof(bytes) };
+    if (!elf_write_all(fd, &iov, 1)) {
+        printf("failed to write file\n");
+        close(fd);
+        return 1;
+    }
 
     close(fd);
     return 0;
@@ -0,0 +1,518 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "encode.h"
+
+/* C */
+#include <stdlib.h>
+#include <string.h>
+
+#define JMP_SHORT_SIZE 2 /* EB rel8 */
+#define JMP_NEAR_SIZE 5  /* E9 rel32 */
+#define JCC_SHORT_SIZE 2 /* 70+cc rel8 */
+#define JCC_NEAR_SIZE 6  /* 0F 80+cc rel32 */
+
+static const uint8_t SHORTEST_SIZE[] = {
+    [INS_DELETED] = 0,
+    [INS_LABEL] = 0,
+    [INS_FORM] = 0, /* sized by instruction_set_form */
+    [INS_JMP] = JMP_SHORT_SIZE,
+    [INS_JCC] = JCC_SHORT_SIZE,
+    [INS_CALL] = 5, /* E8 rel32, there is no rel8 form */
+    [INS_DATA] = 0, /* set by the parser */
+    [INS_SPACE] = 0,
+    [INS_ALIGN] = 0, /* set by relax_branches */
+};
+
+/* the NOPs recommended for each length, longer padding repeats the longest */
+#define NOP_SIZE_MAX 9
+static const uint8_t NOPS[NOP_SIZE_MAX][NOP_SIZE_MAX] = {
+    { 0x90 },
+    { 0x66, 0x90 },
+    { 0x0f, 0x1f, 0x00 },
+    { 0x0f, 0x1f, 0x40, 0x00 },
+    { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+    { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+    { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+    { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 }
+};
+
+void instruction_buffer_init(instruction_buffer_t *buffer)
+{
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void instruction_buffer_fini(instruction_buffer_t *buffer)
+{
+    free(buffer->instructions);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void instruction_buffer_clear(instruction_buffer_t *buffer)
+{
+    buffer->size = 0;
+    buffer->address = 0;
+}
+
+instruction_t *instruction_buffer_append(instruction_buffer_t *buffer,
+                                         instruction_op_t op)
+{
+    if (buffer->size == buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 1024;
+        instruction_t *instructions =
+            realloc(buffer->instructions, capacity * sizeof(*instructions));
+        if (instructions == NULL) {
+            return NULL;
+        }
+        buffer->instructions = instructions;
+        buffer->capacity = capacity;
+    }
+    instruction_t *instruction = &buffer->instructions[buffer->size];
+    ++buffer->size;
+    memset(instruction, 0, sizeof(*instruction));
+    instruction->op = op;
+    instruction->size = SHORTEST_SIZE[op];
+    return instruction;
+}
+
+static bool has_modrm(const instruction_form_t *form)
+{
+    switch (form->encoding) {
+    case ENC_NONE:
+    case ENC_O:
+    case ENC_OI:
+    case ENC_I:
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* the 2 byte VEX prefix implies the 0F map, W0 and no REX.X or REX.B */
+static bool needs_three_byte_vex(const instruction_form_t *form,
+                                 const instruction_t *instruction)
+{
+    return form->map != MAP_0F || (form->flags & FORM_REX_W)
+        || instruction->rm >= 8;
+}
+
+static bool needs_rex(const instruction_form_t *form,
+                      const instruction_t *instruction)
+{
+    return (form->flags & FORM_REX_W) || instruction->reg >= 8
+        || instruction->rm >= 8;
+}
+
+/* returns the size of the displacement of a memory operand */
+static uint8_t displacement_size(const instruction_t *instruction)
+{
+    switch (instruction->rm_mode) {
+    case RM_MEMORY:
+        /* rbp and r13 as a base always take a displacement */
+        if (instruction->displacement == 0 && (instruction->rm & 7) != 5) {
+            return 0;
+        }
+        if (instruction->displacement >= INT8_MIN
+            && instruction->displacement <= INT8_MAX) {
+            return 1;
+        }
+        return 4;
+    case RM_RIP:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static uint8_t form_size(const instruction_form_t *form,
+                         const instruction_t *instruction)
+{
+    uint8_t size = 1 + instruction_form_immediate_size(form);
+    if (form->flags & FORM_VEX) {
+        size += needs_three_byte_vex(form, instruction) ? 3 : 2;
+    }
+    else {
+        size += form->prefix != 0;
+        size += needs_rex(form, instruction);
+        size += form->map == MAP_NONE ? 0 : form->map == MAP_0F ? 1 : 2;
+    }
+    if (has_modrm(form)) {
+        /* rsp and r12 as a base need a SIB byte */
+        size += 1 + displacement_size(instruction);
+        if (instruction->rm_mode == RM_MEMORY && (instruction->rm & 7) == 4) {
+            size += 1;
+        }
+    }
+    return size;
+}
+
+void instruction_set_form(instruction_t *instruction, uint32_t form,
+                          const operand_t *operands)
+{
+    const instruction_form_t *info = &INSTRUCTION_FORMS[form];
+    const operand_t *rm = NULL;
+    const operand_t *immediate = NULL;
+    instruction->op = INS_FORM;
+    instruction->form = form;
+    instruction->reg = 0;
+    instruction->vvvv = 0;
+    switch (info->encoding) {
+    case ENC_NONE:
+        break;
+    case ENC_O:
+        rm = &operands[0];
+        break;
+    case ENC_OI:
+        rm = &operands[0];
+        immediate = &operands[1];
+        break;
+    case ENC_I:
+        immediate = &operands[0];
+        break;
+    case ENC_M:
+        instruction->reg = info->digit;
+        rm = &operands[0];
+        break;
+    case ENC_MI:
+        instruction->reg = info->digit;
+        rm = &operands[0];
+        immediate = &operands[1];
+        break;
+    case ENC_MR:
+        rm = &operands[0];
+        instruction->reg = operands[1].reg;
+        break;
+    case ENC_RM:
+        instruction->reg = operands[0].reg;
+        rm = &operands[1];
+        break;
+    case ENC_RMI:
+        instruction->reg = operands[0].reg;
+        rm = &operands[1];
+        immediate = &operands[2];
+        break;
+    case ENC_RVM:
+        instruction->reg = operands[0].reg;
+        instruction->vvvv = operands[1].reg;
+        rm = &operands[2];
+        break;
+    case ENC_RVMI:
+        instruction->reg = operands[0].reg;
+        instruction->vvvv = operands[1].reg;
+        rm = &operands[2];
+        immediate = &operands[3];
+        break;
+    }
+
+    instruction->rm = 0;
+    instruction->rm_mode = RM_REGISTER;
+    instruction->displacement = 0;
+    if (rm != NULL) {
+        instruction->rm = rm->reg;
+        if (rm->type == OPERAND_MEMORY) {
+            instruction->rm_mode = RM_MEMORY;
+            instruction->displacement = rm->displacement;
+            if (rm->label != SYMBOL_NONE) {
+                /* ModRM.rm 101 with mod 00 is rip relative */
+                instruction->rm_mode = RM_RIP;
+                instruction->rm = 5;
+                instruction->label = rm->label;
+            }
+        }
+    }
+    instruction->immediate = immediate != NULL ? immediate->immediate : 0;
+    instruction->size = form_size(info, instruction);
+}
+
+void instruction_set_zero(instruction_t *instruction)
+{
+    operand_t operands[2];
+    memset(operands, 0, sizeof(operands));
+    operands[0].type = OPERAND_REGISTER;
+    operands[0].register_class = REGISTER_R32;
+    operands[0].reg = instruction->rm;
+    operands[1] = operands[0];
+    instruction_set_form(instruction, FORM_ZERO_IDIOM, operands);
+}
+
+bool instruction_has_label(const instruction_t *instruction)
+{
+    switch (instruction->op) {
+    case INS_LABEL:
+    case INS_JMP:
+    case INS_JCC:
+    case INS_CALL:
+        return true;
+    case INS_FORM:
+        return instruction->rm_mode == RM_RIP;
+    default:
+        return false;
+    }
+}
+
+static bool is_short_branch(const instruction_t *instruction)
+{
+    return (instruction->op == INS_JMP && instruction->size == JMP_SHORT_SIZE)
+        || (instruction->op == INS_JCC
+            && instruction->size == JCC_SHORT_SIZE);
+}
+
+/* the immediate is the only thing encoded after the displacement */
+uint8_t instruction_label_field(const instruction_t *instruction)
+{
+    switch (instruction->op) {
+    case INS_JMP:
+    case INS_JCC:
+        return is_short_branch(instruction) ? 0 : 4;
+    case INS_CALL:
+        return 4;
+    case INS_FORM:
+        if (instruction->rm_mode != RM_RIP) {
+            return 0;
+        }
+        return 4 + instruction_form_immediate_size(
+            &INSTRUCTION_FORMS[instruction->form]);
+    default:
+        return 0;
+    }
+}
+
+uint64_t instruction_length(const instruction_t *instruction)
+{
+    switch (instruction->op) {
+    case INS_LABEL:
+    case INS_SPACE:
+    case INS_ALIGN:
+        return instruction->immediate;
+    default:
+        return instruction->size;
+    }
+}
+
+/* sets the padding of an alignment or aligned label at address */
+static void align_instruction(instruction_t *instruction, uint64_t address)
+{
+    if (instruction->op == INS_ALIGN
+        || (instruction->op == INS_LABEL && instruction->reg != 0)) {
+        uint64_t mask = ((uint64_t) 1 << instruction->reg) - 1;
+        instruction->immediate = -address & mask;
+    }
+}
+
+uint64_t relax_branches(instruction_buffer_t *const *buffers,
+                        size_t buffers_size, uint64_t start,
+                        uint64_t *label_addresses)
+{
+    uint64_t address;
+    bool is_changed = true;
+    while (is_changed) {
+        is_changed = false;
+
+        /* lay out every instruction with the current sizes */
+        address = start;
+        for (size_t b = 0; b < buffers_size; ++b) {
+            instruction_buffer_t *buffer = buffers[b];
+            buffer->address = address;
+            for (size_t i = 0; i < buffer->size; ++i) {
+                instruction_t *instruction = &buffer->instructions[i];
+                align_instruction(instruction, address);
+                address += instruction_length(instruction);
+                if (instruction->op == INS_LABEL) {
+                    label_addresses[instruction->label] = address;
+                }
+            }
+        }
+
+        /* grow the short branches that do not reach in that layout, padding
+           may shrink again but a branch is never made short again, which
+           is still correct */
+        for (size_t b = 0; b < buffers_size; ++b) {
+            instruction_buffer_t *buffer = buffers[b];
+            uint64_t end = buffer->address;
+            for (size_t i = 0; i < buffer->size; ++i) {
+                instruction_t *instruction = &buffer->instructions[i];
+                end += instruction_length(instruction);
+                if (!is_short_branch(instruction)) {
+                    continue;
+                }
+                int64_t displacement =
+                    label_addresses[instruction->label] - end;
+                if (displacement >= INT8_MIN && displacement <= INT8_MAX) {
+                    continue;
+                }
+                instruction->size = instruction->op == INS_JMP
+                    ? JMP_NEAR_SIZE : JCC_NEAR_SIZE;
+                is_changed = true;
+            }
+        }
+    }
+    return address - start;
+}
+
+static const uint8_t VEX_PP[256] = {
+    [0x66] = 1, [0xf3] = 2, [0xf2] = 3
+};
+
+/* encodes prefixes, opcode, ModRM, SIB, displacement and immediate as the
+   form describes, displacement is the rip relative one for RM_RIP */
+static void encode_form(const instruction_t *instruction,
+                        int32_t displacement, uint8_t *bytes)
+{
+    const instruction_form_t *form = &INSTRUCTION_FORMS[instruction->form];
+    uint8_t w = (form->flags & FORM_REX_W) != 0;
+    uint8_t r = instruction->reg >> 3;
+    uint8_t b = instruction->rm >> 3;
+    if (form->flags & FORM_VEX) {
+        /* R, X, B and vvvv are stored inverted */
+        uint8_t l = (form->flags & FORM_VEX_L) != 0;
+        uint8_t last = ((~instruction->vvvv & 15) << 3) | (l << 2)
+            | VEX_PP[form->prefix];
+        if (needs_three_byte_vex(form, instruction)) {
+            *bytes++ = 0xc4;
+            *bytes++ = (!r << 7) | (1 << 6) | (!b << 5) | form->map;
+            *bytes++ = (w << 7) | last;
+        }
+        else {
+            *bytes++ = 0xc5;
+            *bytes++ = (!r << 7) | last;
+        }
+    }
+    else {
+        if (form->prefix != 0) {
+            *bytes++ = form->prefix;
+        }
+        if (needs_rex(form, instruction)) {
+            *bytes++ = 0x40 | (w << 3) | (r << 2) | b;
+        }
+        if (form->map != MAP_NONE) {
+            *bytes++ = 0x0f;
+        }
+        if (form->map == MAP_0F38) {
+            *bytes++ = 0x38;
+        }
+        else if (form->map == MAP_0F3A) {
+            *bytes++ = 0x3a;
+        }
+    }
+
+    if (form->encoding == ENC_O || form->encoding == ENC_OI) {
+        *bytes++ = form->opcode | (instruction->rm & 7);
+    }
+    else {
+        *bytes++ = form->opcode;
+    }
+
+    if (has_modrm(form)) {
+        uint8_t reg = (instruction->reg & 7) << 3;
+        uint8_t rm = instruction->rm & 7;
+        uint8_t size = displacement_size(instruction);
+        switch (instruction->rm_mode) {
+        case RM_REGISTER:
+            *bytes++ = 0xc0 | reg | rm;
+            break;
+        case RM_MEMORY:
+            displacement = instruction->displacement;
+            *bytes++ = (size == 0 ? 0x00 : size == 1 ? 0x40 : 0x80)
+                | reg | rm;
+            if (rm == 4) {
+                *bytes++ = 0x24; /* no index, base in ModRM.rm */
+            }
+            break;
+        case RM_RIP:
+            *bytes++ = 0x05 | reg;
+            break;
+        }
+        memcpy(bytes, &displacement, size);
+        bytes += size;
+    }
+    memcpy(bytes, &instruction->immediate,
+           instruction_form_immediate_size(form));
+}
+
+static void encode_padding(uint8_t *bytes, uint64_t size, bool is_text)
+{
+    if (!is_text) {
+        memset(bytes, 0, size);
+        return;
+    }
+    while (size > 0) {
+        uint64_t nop_size = size < NOP_SIZE_MAX ? size : NOP_SIZE_MAX;
+        memcpy(bytes, NOPS[nop_size - 1], nop_size);
+        bytes += nop_size;
+        size -= nop_size;
+    }
+}
+
+void encode_instructions(const instruction_buffer_t *buffer,
+                         const uint64_t *label_addresses, uint8_t *bytes,
+                         bool is_text)
+{
+    uint64_t address = buffer->address;
+    for (size_t i = 0; i < buffer->size; ++i) {
+        const instruction_t *instruction = &buffer->instructions[i];
+        address += instruction_length(instruction);
+        int32_t displacement = 0;
+        if (instruction_has_label(instruction)) {
+            displacement = label_addresses[instruction->label]
+                + instruction->displacement - address;
+        }
+
+        switch (instruction->op) {
+        case INS_DELETED:
+            break;
+        case INS_LABEL:
+        case INS_ALIGN:
+            encode_padding(bytes, instruction->immediate, is_text);
+            break;
+        case INS_FORM:
+            encode_form(instruction, displacement, bytes);
+            break;
+        case INS_JMP:
+            if (instruction->size == JMP_SHORT_SIZE) {
+                bytes[0] = 0xeb;
+                bytes[1] = displacement;
+            }
+            else {
+                bytes[0] = 0xe9;
+                memcpy(bytes + 1, &displacement, 4);
+            }
+            break;
+        case INS_JCC:
+            if (instruction->size == JCC_SHORT_SIZE) {
+                bytes[0] = 0x70 | instruction->reg;
+                bytes[1] = displacement;
+            }
+            else {
+                bytes[0] = 0x0f;
+                bytes[1] = 0x80 | instruction->reg;
+                memcpy(bytes + 2, &displacement, 4);
+            }
+            break;
+        case INS_CALL:
+            bytes[0] = 0xe8;
+            memcpy(bytes + 1, &displacement, 4);
+            break;
+        case INS_DATA:
+            memcpy(bytes, &instruction->immediate, instruction->size);
+            break;
+        case INS_SPACE:
+            memset(bytes, 0, instruction->immediate);
+            break;
+        }
+        bytes += instruction_length(instruction);
+    }
+}
@@ -0,0 +1,121 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_ENCODE_H
+#define EYL_ENCODE_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "form.h"
+
+/* Parsed instructions are kept until every label is known, then branch sizes
+   are chosen and the instructions are encoded. Branches are kept apart from
+   the other forms since their size depends on the layout. */
+
+typedef enum {
+    INS_DELETED, /* removed by an optimization, no bytes */
+    INS_LABEL,   /* defines label at the next instruction, no bytes unless
+                    it is aligned like INS_ALIGN */
+    INS_FORM,    /* a row of INSTRUCTION_FORMS applied to its operands */
+    INS_JMP,     /* jmp label */
+    INS_JCC,     /* j<condition> label */
+    INS_CALL,    /* call label */
+    INS_DATA,    /* the low size bytes of immediate */
+    INS_SPACE,   /* immediate zero bytes, size is unused */
+    INS_ALIGN    /* immediate bytes of padding up to a multiple of 1 << reg,
+                    which relaxation sets */
+} instruction_op_t;
+
+/* what the rm field of an INS_FORM addresses */
+typedef enum {
+    RM_REGISTER,
+    RM_MEMORY, /* [rm + displacement] */
+    RM_RIP     /* [label + displacement], rip relative */
+} rm_mode_t;
+
+typedef struct {
+    uint8_t op;
+    uint8_t size;    /* encoded size in bytes */
+    uint16_t form;   /* index in INSTRUCTION_FORMS */
+    uint8_t reg;     /* ModRM.reg, or the condition code for INS_JCC */
+    uint8_t rm;      /* ModRM.rm or the register in the opcode */
+    uint8_t vvvv;    /* VEX.vvvv */
+    uint8_t rm_mode; /* rm_mode_t */
+    uint32_t label;
+    int32_t displacement;
+    uint64_t immediate;
+} instruction_t;
+
+typedef struct {
+    instruction_t *instructions;
+    size_t size;
+    size_t capacity;
+    uint64_t address; /* offset of the first instruction once relaxed */
+} instruction_buffer_t;
+
+void instruction_buffer_init(instruction_buffer_t *buffer);
+void instruction_buffer_fini(instruction_buffer_t *buffer);
+
+/* removes every instruction, keeping the memory for the next ones */
+void instruction_buffer_clear(instruction_buffer_t *buffer);
+
+/* returns a new instruction sized for its shortest encoding, or NULL if the
+   buffer could not grow */
+instruction_t *instruction_buffer_append(instruction_buffer_t *buffer,
+                                         instruction_op_t op);
+
+/* makes the instruction the form applied to the operands (which the form
+   must take) and sizes it */
+void instruction_set_form(instruction_t *instruction, uint32_t form,
+                          const operand_t *operands);
+
+/* makes the instruction xor reg32, reg32 of its register operand */
+void instruction_set_zero(instruction_t *instruction);
+
+/* returns whether the label field is used (labels, branches and rip
+   relative operands) */
+bool instruction_has_label(const instruction_t *instruction);
+
+/* returns the number of bytes the instruction takes */
+uint64_t instruction_length(const instruction_t *instruction);
+
+/* returns how far before the end of the instruction the rel32 it encodes
+   its label with starts, or 0 if there is none (labels and short
+   branches), the field holds label + displacement - end */
+uint8_t instruction_label_field(const instruction_t *instruction);
+
+/* Chooses the size of every branch across the buffers (in order) so short
+   rel8 forms are used whenever the displacement fits, and the padding of
+   every alignment. Branches start short and only ever grow, so iterating
+   until nothing changes terminates, and each iteration is two linear
+   passes. The first buffer starts at address, which must be aligned to the
+   largest alignment in the buffers, label_addresses receives the address of
+   every label in the buffers; the total size is returned. */
+uint64_t relax_branches(instruction_buffer_t *const *buffers,
+                        size_t buffers_size, uint64_t address,
+                        uint64_t *label_addresses);
+
+/* encodes the buffer as if it were at its relaxed address into bytes, which
+   must have room for every instruction, alignment is padded with NOPs if
+   is_text and zeros otherwise */
+void encode_instructions(const instruction_buffer_t *buffer,
+                         const uint64_t *label_addresses, uint8_t *bytes,
+                         bool is_text);
+
+#endif
@@ -0,0 +1,359 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "form.h"
+
+#define FORM(mnemonic, op0, op1, op2, encoding, prefix, map, opcode, digit, \
+             flags) \
+    { mnemonic, { OPD_##op0, OPD_##op1, OPD_##op2, OPD_NONE }, \
+      ENC_##encoding, prefix, MAP_##map, opcode, digit, flags }
+
+/* the few forms with a fourth operand, which is always an 8-bit immediate */
+#define FORM4(mnemonic, op0, op1, op2, prefix, map, opcode, flags) \
+    { mnemonic, { OPD_##op0, OPD_##op1, OPD_##op2, OPD_UIMM8 }, ENC_RVMI, \
+      prefix, MAP_##map, opcode, 0, flags }
+
+#define REX_W FORM_REX_W
+#define VEX FORM_VEX
+#define VEX_L (FORM_VEX | FORM_VEX_L)
+#define SETS FORM_SETS_FLAGS
+#define READS FORM_READS_FLAGS
+#define MOV_IMM FORM_MOV_IMM
+
+/* add, or, adc, sbb, and, sub, xor and cmp share one opcode layout */
+#define ALU(mnemonic, base, digit, flags) \
+    FORM(mnemonic, RM64, R64, NONE, MR, 0, NONE, base + 1, 0, REX_W | flags), \
+    FORM(mnemonic, R64, RM64, NONE, RM, 0, NONE, base + 3, 0, REX_W | flags), \
+    FORM(mnemonic, RM64, SIMM8, NONE, MI, 0, NONE, 0x83, digit, \
+         REX_W | flags), \
+    FORM(mnemonic, RM64, SIMM32, NONE, MI, 0, NONE, 0x81, digit, \
+         REX_W | flags), \
+    FORM(mnemonic, RM32, R32, NONE, MR, 0, NONE, base + 1, 0, flags), \
+    FORM(mnemonic, R32, RM32, NONE, RM, 0, NONE, base + 3, 0, flags), \
+    FORM(mnemonic, RM32, SIMM8, NONE, MI, 0, NONE, 0x83, digit, flags), \
+    FORM(mnemonic, RM32, IMM32, NONE, MI, 0, NONE, 0x81, digit, flags)
+
+/* a one operand group 3 or group 5 instruction */
+#define UNARY(mnemonic, opcode, digit, flags) \
+    FORM(mnemonic, RM64, NONE, NONE, M, 0, NONE, opcode, digit, \
+         REX_W | flags), \
+    FORM(mnemonic, RM32, NONE, NONE, M, 0, NONE, opcode, digit, flags)
+
+#define SHIFT(mnemonic, digit) \
+    FORM(mnemonic, RM64, UIMM8, NONE, MI, 0, NONE, 0xc1, digit, REX_W), \
+    FORM(mnemonic, RM32, UIMM8, NONE, MI, 0, NONE, 0xc1, digit, 0)
+
+#define CMOV(mnemonic, condition) \
+    FORM(mnemonic, R64, RM64, NONE, RM, 0, 0F, 0x40 | condition, 0, \
+         REX_W | READS), \
+    FORM(mnemonic, R32, RM32, NONE, RM, 0, 0F, 0x40 | condition, 0, READS)
+
+/* xmm, xmm/m128 */
+#define SSE(mnemonic, prefix, opcode) \
+    FORM(mnemonic, XMM, XMM_M, NONE, RM, prefix, 0F, opcode, 0, 0)
+
+/* a load and a store, register to register moves use the load */
+#define SSE_MOVE(mnemonic, prefix, load, store) \
+    FORM(mnemonic, XMM, XMM_M, NONE, RM, prefix, 0F, load, 0, 0), \
+    FORM(mnemonic, XMM_M, XMM, NONE, MR, prefix, 0F, store, 0, 0)
+
+/* xmm, xmm, xmm/m128 and ymm, ymm, ymm/m256 */
+#define AVX(mnemonic, prefix, map, opcode) \
+    FORM(mnemonic, XMM, XMM, XMM_M, RVM, prefix, map, opcode, 0, VEX), \
+    FORM(mnemonic, YMM, YMM, YMM_M, RVM, prefix, map, opcode, 0, VEX_L)
+
+#define AVX_MOVE(mnemonic, prefix, load, store) \
+    FORM(mnemonic, XMM, XMM_M, NONE, RM, prefix, 0F, load, 0, VEX), \
+    FORM(mnemonic, XMM_M, XMM, NONE, MR, prefix, 0F, store, 0, VEX), \
+    FORM(mnemonic, YMM, YMM_M, NONE, RM, prefix, 0F, load, 0, VEX_L), \
+    FORM(mnemonic, YMM_M, YMM, NONE, MR, prefix, 0F, store, 0, VEX_L)
+
+const instruction_form_t INSTRUCTION_FORMS[] = {
+    /* general purpose */
+    ALU("xor", 0x30, 6, SETS),
+    ALU("add", 0x00, 0, SETS),
+    ALU("or", 0x08, 1, SETS),
+    ALU("adc", 0x10, 2, READS | SETS),
+    ALU("sbb", 0x18, 3, READS | SETS),
+    ALU("and", 0x20, 4, SETS),
+    ALU("sub", 0x28, 5, SETS),
+    ALU("cmp", 0x38, 7, SETS),
+    FORM("mov", RM64, R64, NONE, MR, 0, NONE, 0x89, 0, REX_W),
+    FORM("mov", R64, RM64, NONE, RM, 0, NONE, 0x8b, 0, REX_W),
+    /* a 32-bit move zeroes the upper half, so it is shortest when the
+       immediate is zero-extended */
+    FORM("mov", R64, UIMM32, NONE, OI, 0, NONE, 0xb8, 0, MOV_IMM),
+    FORM("mov", RM64, SIMM32, NONE, MI, 0, NONE, 0xc7, 0, REX_W | MOV_IMM),
+    FORM("mov", R64, IMM64, NONE, OI, 0, NONE, 0xb8, 0, REX_W | MOV_IMM),
+    FORM("mov", RM32, R32, NONE, MR, 0, NONE, 0x89, 0, 0),
+    FORM("mov", R32, RM32, NONE, RM, 0, NONE, 0x8b, 0, 0),
+    FORM("mov", R32, IMM32, NONE, OI, 0, NONE, 0xb8, 0, MOV_IMM),
+    FORM("mov", RM32, IMM32, NONE, MI, 0, NONE, 0xc7, 0, MOV_IMM),
+    FORM("test", RM64, R64, NONE, MR, 0, NONE, 0x85, 0, REX_W | SETS),
+    FORM("test", RM64, SIMM32, NONE, MI, 0, NONE, 0xf7, 0, REX_W | SETS),
+    FORM("test", RM32, R32, NONE, MR, 0, NONE, 0x85, 0, SETS),
+    FORM("test", RM32, IMM32, NONE, MI, 0, NONE, 0xf7, 0, SETS),
+    /* inc and dec keep the carry flag, so they neither set nor read all of
+       them */
+    UNARY("inc", 0xff, 0, 0),
+    UNARY("dec", 0xff, 1, 0),
+    UNARY("not", 0xf7, 2, 0),
+    UNARY("neg", 0xf7, 3, SETS),
+    FORM("imul", R64, RM64, NONE, RM, 0, 0F, 0xaf, 0, REX_W | SETS),
+    FORM("imul", R64, RM64, SIMM8, RMI, 0, NONE, 0x6b, 0, REX_W | SETS),
+    FORM("imul", R64, RM64, SIMM32, RMI, 0, NONE, 0x69, 0, REX_W | SETS),
+    FORM("imul", R32, RM32, NONE, RM, 0, 0F, 0xaf, 0, SETS),
+    FORM("imul", R32, RM32, SIMM8, RMI, 0, NONE, 0x6b, 0, SETS),
+    FORM("imul", R32, RM32, IMM32, RMI, 0, NONE, 0x69, 0, SETS),
+    /* a shift by zero leaves the flags alone */
+    SHIFT("shl", 4),
+    SHIFT("shr", 5),
+    SHIFT("sar", 7),
+    CMOV("cmovo", 0x0),
+    CMOV("cmovno", 0x1),
+    CMOV("cmovb", 0x2),
+    CMOV("cmovae", 0x3),
+    CMOV("cmove", 0x4),
+    CMOV("cmovne", 0x5),
+    CMOV("cmovbe", 0x6),
+    CMOV("cmova", 0x7),
+    CMOV("cmovs", 0x8),
+    CMOV("cmovns", 0x9),
+    CMOV("cmovl", 0xc),
+    CMOV("cmovge", 0xd),
+    CMOV("cmovle", 0xe),
+    CMOV("cmovg", 0xf),
+    FORM("lea", R64, M, NONE, RM, 0, NONE, 0x8d, 0, REX_W),
+    FORM("push", R64, NONE, NONE, O, 0, NONE, 0x50, 0, 0),
+    FORM("push", SIMM8, NONE, NONE, I, 0, NONE, 0x6a, 0, 0),
+    FORM("push", SIMM32, NONE, NONE, I, 0, NONE, 0x68, 0, 0),
+    FORM("push", M, NONE, NONE, M, 0, NONE, 0xff, 6, 0),
+    FORM("pop", R64, NONE, NONE, O, 0, NONE, 0x58, 0, 0),
+    FORM("pop", M, NONE, NONE, M, 0, NONE, 0x8f, 0, 0),
+    FORM("popcnt", R64, RM64, NONE, RM, 0xf3, 0F, 0xb8, 0, REX_W | SETS),
+    FORM("lzcnt", R64, RM64, NONE, RM, 0xf3, 0F, 0xbd, 0, REX_W | SETS),
+    FORM("tzcnt", R64, RM64, NONE, RM, 0xf3, 0F, 0xbc, 0, REX_W | SETS),
+    FORM("cqo", NONE, NONE, NONE, NONE, 0, NONE, 0x99, 0, REX_W),
+    FORM("nop", NONE, NONE, NONE, NONE, 0, NONE, 0x90, 0, 0),
+    FORM("int3", NONE, NONE, NONE, NONE, 0, NONE, 0xcc, 0, 0),
+    FORM("ud2", NONE, NONE, NONE, NONE, 0, 0F, 0x0b, 0, 0),
+    /* the kernel preserves the flags across a system call */
+    FORM("syscall", NONE, NONE, NONE, NONE, 0, 0F, 0x05, 0, 0),
+    /* the caller may still read the flags */
+    FORM("ret", NONE, NONE, NONE, NONE, 0, NONE, 0xc3, 0, READS),
+
+    /* SSE2 */
+    SSE_MOVE("movdqa", 0x66, 0x6f, 0x7f),
+    SSE_MOVE("movdqu", 0xf3, 0x6f, 0x7f),
+    SSE_MOVE("movaps", 0, 0x28, 0x29),
+    SSE_MOVE("movapd", 0x66, 0x28, 0x29),
+    SSE_MOVE("movups", 0, 0x10, 0x11),
+    SSE_MOVE("movupd", 0x66, 0x10, 0x11),
+    FORM("movd", XMM, RM32, NONE, RM, 0x66, 0F, 0x6e, 0, 0),
+    FORM("movd", RM32, XMM, NONE, MR, 0x66, 0F, 0x7e, 0, 0),
+    FORM("movq", XMM, RM64, NONE, RM, 0x66, 0F, 0x6e, 0, REX_W),
+    FORM("movq", RM64, XMM, NONE, MR, 0x66, 0F, 0x7e, 0, REX_W),
+    SSE("paddb", 0x66, 0xfc),
+    SSE("paddw", 0x66, 0xfd),
+    SSE("paddd", 0x66, 0xfe),
+    SSE("paddq", 0x66, 0xd4),
+    SSE("psubb", 0x66, 0xf8),
+    SSE("psubw", 0x66, 0xf9),
+    SSE("psubd", 0x66, 0xfa),
+    SSE("psubq", 0x66, 0xfb),
+    SSE("pmullw", 0x66, 0xd5),
+    SSE("pmuludq", 0x66, 0xf4),
+    SSE("pand", 0x66, 0xdb),
+    SSE("pandn", 0x66, 0xdf),
+    SSE("por", 0x66, 0xeb),
+    SSE("pxor", 0x66, 0xef),
+    SSE("pcmpeqb", 0x66, 0x74),
+    SSE("pcmpeqw", 0x66, 0x75),
+    SSE("pcmpeqd", 0x66, 0x76),
+    SSE("pcmpgtb", 0x66, 0x64),
+    SSE("pcmpgtw", 0x66, 0x65),
+    SSE("pcmpgtd", 0x66, 0x66),
+    SSE("punpcklbw", 0x66, 0x60),
+    SSE("punpckhbw", 0x66, 0x68),
+    SSE("addps", 0, 0x58),
+    SSE("addpd", 0x66, 0x58),
+    SSE("addss", 0xf3, 0x58),
+    SSE("addsd", 0xf2, 0x58),
+    SSE("subps", 0, 0x5c),
+    SSE("subpd", 0x66, 0x5c),
+    SSE("subss", 0xf3, 0x5c),
+    SSE("subsd", 0xf2, 0x5c),
+    SSE("mulps", 0, 0x59),
+    SSE("mulpd", 0x66, 0x59),
+    SSE("mulss", 0xf3, 0x59),
+    SSE("mulsd", 0xf2, 0x59),
+    SSE("divps", 0, 0x5e),
+    SSE("divpd", 0x66, 0x5e),
+    SSE("divss", 0xf3, 0x5e),
+    SSE("divsd", 0xf2, 0x5e),
+    SSE("sqrtps", 0, 0x51),
+    SSE("sqrtpd", 0x66, 0x51),
+    SSE("sqrtss", 0xf3, 0x51),
+    SSE("sqrtsd", 0xf2, 0x51),
+    SSE("andps", 0, 0x54),
+    SSE("andpd", 0x66, 0x54),
+    SSE("orps", 0, 0x56),
+    SSE("orpd", 0x66, 0x56),
+    SSE("xorps", 0, 0x57),
+    SSE("xorpd", 0x66, 0x57),
+    FORM("pmovmskb", R32, XMM, NONE, RM, 0x66, 0F, 0xd7, 0, 0),
+    FORM("pshufd", XMM, XMM_M, UIMM8, RMI, 0x66, 0F, 0x70, 0, 0),
+    FORM("psrlq", XMM, UIMM8, NONE, MI, 0x66, 0F, 0x73, 2, 0),
+    FORM("psllq", XMM, UIMM8, NONE, MI, 0x66, 0F, 0x73, 6, 0),
+
+    /* AVX and AVX2 */
+    AVX_MOVE("vmovdqa", 0x66, 0x6f, 0x7f),
+    AVX_MOVE("vmovdqu", 0xf3, 0x6f, 0x7f),
+    AVX_MOVE("vmovaps", 0, 0x28, 0x29),
+    AVX_MOVE("vmovups", 0, 0x10, 0x11),
+    AVX("vpaddb", 0x66, 0F, 0xfc),
+    AVX("vpaddw", 0x66, 0F, 0xfd),
+    AVX("vpaddd", 0x66, 0F, 0xfe),
+    AVX("vpaddq", 0x66, 0F, 0xd4),
+    AVX("vpsubb", 0x66, 0F, 0xf8),
+    AVX("vpsubw", 0x66, 0F, 0xf9),
+    AVX("vpsubd", 0x66, 0F, 0xfa),
+    AVX("vpsubq", 0x66, 0F, 0xfb),
+    AVX("vpmullw", 0x66, 0F, 0xd5),
+    AVX("vpmulld", 0x66, 0F38, 0x40),
+    AVX("vpand", 0x66, 0F, 0xdb),
+    AVX("vpandn", 0x66, 0F, 0xdf),
+    AVX("vpor", 0x66, 0F, 0xeb),
+    AVX("vpxor", 0x66, 0F, 0xef),
+    AVX("vpcmpeqb", 0x66, 0F, 0x74),
+    AVX("vpcmpeqw", 0x66, 0F, 0x75),
+    AVX("vpcmpeqd", 0x66, 0F, 0x76),
+    AVX("vpcmpeqq", 0x66, 0F38, 0x29),
+    AVX("vpcmpgtb", 0x66, 0F, 0x64),
+    AVX("vpcmpgtd", 0x66, 0F, 0x66),
+    AVX("vpshufb", 0x66, 0F38, 0x00),
+    AVX("vpminub", 0x66, 0F, 0xda),
+    AVX("vpmaxub", 0x66, 0F, 0xde),
+    AVX("vaddps", 0, 0F, 0x58),
+    AVX("vaddpd", 0x66, 0F, 0x58),
+    AVX("vsubps", 0, 0F, 0x5c),
+    AVX("vsubpd", 0x66, 0F, 0x5c),
+    AVX("vmulps", 0, 0F, 0x59),
+    AVX("vmulpd", 0x66, 0F, 0x59),
+    AVX("vdivps", 0, 0F, 0x5e),
+    AVX("vdivpd", 0x66, 0F, 0x5e),
+    AVX("vandps", 0, 0F, 0x54),
+    AVX("vorps", 0, 0F, 0x56),
+    AVX("vxorps", 0, 0F, 0x57),
+    FORM("vpmovmskb", R32, XMM, NONE, RM, 0x66, 0F, 0xd7, 0, VEX),
+    FORM("vpmovmskb", R32, YMM, NONE, RM, 0x66, 0F, 0xd7, 0, VEX_L),
+    FORM("vpshufd", XMM, XMM_M, UIMM8, RMI, 0x66, 0F, 0x70, 0, VEX),
+    FORM("vpshufd", YMM, YMM_M, UIMM8, RMI, 0x66, 0F, 0x70, 0, VEX_L),
+    FORM("vpbroadcastb", YMM, XMM_M, NONE, RM, 0x66, 0F38, 0x78, 0, VEX_L),
+    FORM("vpbroadcastd", YMM, XMM_M, NONE, RM, 0x66, 0F38, 0x58, 0, VEX_L),
+    FORM("vpbroadcastq", YMM, XMM_M, NONE, RM, 0x66, 0F38, 0x59, 0, VEX_L),
+    FORM("vpermq", YMM, YMM_M, UIMM8, RMI, 0x66, 0F3A, 0x00, 0,
+         VEX_L | REX_W),
+    FORM4("vperm2i128", YMM, YMM, YMM_M, 0x66, 0F3A, 0x46, VEX_L),
+    FORM4("vpblendd", XMM, XMM, XMM_M, 0x66, 0F3A, 0x02, VEX),
+    FORM4("vpblendd", YMM, YMM, YMM_M, 0x66, 0F3A, 0x02, VEX_L),
+    FORM("vzeroupper", NONE, NONE, NONE, NONE, 0, 0F, 0x77, 0, VEX)
+};
+const size_t INSTRUCTION_FORMS_SIZE =
+    sizeof(INSTRUCTION_FORMS) / sizeof(INSTRUCTION_FORMS[0]);
+
+static bool operand_fits(uint8_t kind, const operand_t *operand)
+{
+    bool is_register = operand->type == OPERAND_REGISTER;
+    bool is_memory = operand->type == OPERAND_MEMORY;
+    bool is_immediate = operand->type == OPERAND_IMMEDIATE;
+    uint8_t register_class = operand->register_class;
+    int64_t value = operand->immediate;
+    switch (kind) {
+    case OPD_R32:
+        return is_register && register_class == REGISTER_R32;
+    case OPD_R64:
+        return is_register && register_class == REGISTER_R64;
+    case OPD_RM32:
+        return is_memory || (is_register && register_class == REGISTER_R32);
+    case OPD_RM64:
+        return is_memory || (is_register && register_class == REGISTER_R64);
+    case OPD_M:
+        return is_memory;
+    case OPD_XMM:
+        return is_register && register_class == REGISTER_XMM;
+    case OPD_XMM_M:
+        return is_memory || (is_register && register_class == REGISTER_XMM);
+    case OPD_YMM:
+        return is_register && register_class == REGISTER_YMM;
+    case OPD_YMM_M:
+        return is_memory || (is_register && register_class == REGISTER_YMM);
+    case OPD_SIMM8:
+        return is_immediate && value >= INT8_MIN && value <= INT8_MAX;
+    case OPD_UIMM8:
+        return is_immediate && operand->immediate <= UINT8_MAX;
+    case OPD_SIMM32:
+        return is_immediate && value >= INT32_MIN && value <= INT32_MAX;
+    case OPD_UIMM32:
+        return is_immediate && operand->immediate <= UINT32_MAX;
+    case OPD_IMM32:
+        return is_immediate && value >= INT32_MIN && value <= UINT32_MAX;
+    case OPD_IMM64:
+        return is_immediate;
+    default:
+        return false;
+    }
+}
+
+int32_t instruction_form_match(uint32_t first, uint32_t size,
+                               const operand_t *operands,
+                               size_t operands_size)
+{
+    for (uint32_t i = first; i < first + size; ++i) {
+        const instruction_form_t *form = &INSTRUCTION_FORMS[i];
+        size_t j = 0;
+        while (j < operands_size && j < FORM_OPERANDS_MAX
+               && operand_fits(form->operands[j], &operands[j])) {
+            ++j;
+        }
+        if (j == operands_size
+            && (j == FORM_OPERANDS_MAX || form->operands[j] == OPD_NONE)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint8_t instruction_form_immediate_size(const instruction_form_t *form)
+{
+    for (size_t i = 0; i < FORM_OPERANDS_MAX; ++i) {
+        switch (form->operands[i]) {
+        case OPD_SIMM8:
+        case OPD_UIMM8:
+            return 1;
+        case OPD_SIMM32:
+        case OPD_UIMM32:
+        case OPD_IMM32:
+            return 4;
+        case OPD_IMM64:
+            return 8;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef EYL_FORM_H
+#define EYL_FORM_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "symbol_table.h"
+
+/* Every encodable instruction is a row of INSTRUCTION_FORMS: the operands it
+   takes, how they map onto the ModRM, VEX.vvvv and opcode fields, and the
+   opcode bytes. The forms of a mnemonic are adjacent and ordered so the
+   first one that takes the operands is the shortest. */
+
+/* what a form accepts for an operand */
+typedef enum {
+    OPD_NONE,
+    OPD_R32,    /* 32-bit general purpose register */
+    OPD_R64,    /* 64-bit general purpose register */
+    OPD_RM32,   /* 32-bit register or memory */
+    OPD_RM64,   /* 64-bit register or memory */
+    OPD_M,      /* memory only */
+    OPD_XMM,
+    OPD_XMM_M,  /* xmm register or memory */
+    OPD_YMM,
+    OPD_YMM_M,  /* ymm register or memory */
+    OPD_SIMM8,  /* sign-extended 8-bit immediate */
+    OPD_UIMM8,  /* 8-bit immediate from 0 to 255 */
+    OPD_SIMM32, /* sign-extended 32-bit immediate */
+    OPD_UIMM32, /* zero-extended 32-bit immediate */
+    OPD_IMM32,  /* any 32-bit value, for 32-bit operations */
+    OPD_IMM64
+} operand_kind_t;
+
+/* where the operands go */
+typedef enum {
+    ENC_NONE, /* no operands */
+    ENC_O,    /* operand 0 in the low opcode bits */
+    ENC_OI,   /* operand 0 in the low opcode bits, operand 1 immediate */
+    ENC_I,    /* operand 0 immediate */
+    ENC_M,    /* operand 0 in ModRM.rm, ModRM.reg is the digit */
+    ENC_MI,   /* as ENC_M, operand 1 immediate */
+    ENC_MR,   /* operand 0 in ModRM.rm, operand 1 in ModRM.reg */
+    ENC_RM,   /* operand 0 in ModRM.reg, operand 1 in ModRM.rm */
+    ENC_RMI,  /* as ENC_RM, operand 2 immediate */
+    ENC_RVM,  /* operand 0 in ModRM.reg, 1 in VEX.vvvv, 2 in ModRM.rm */
+    ENC_RVMI  /* as ENC_RVM, operand 3 immediate */
+} operand_encoding_t;
+
+typedef enum {
+    MAP_NONE, /* one byte opcodes */
+    MAP_0F,
+    MAP_0F38,
+    MAP_0F3A
+} opcode_map_t;
+
+#define FORM_REX_W        0x01 /* 64-bit operand size (REX.W or VEX.W1) */
+#define FORM_VEX          0x02 /* VEX encoded */
+#define FORM_VEX_L        0x04 /* 256-bit vector length */
+#define FORM_SETS_FLAGS   0x08 /* every status flag is written */
+#define FORM_READS_FLAGS  0x10 /* the status flags may be read */
+#define FORM_MOV_IMM      0x20 /* writes operand 0 and nothing else */
+
+#define FORM_OPERANDS_MAX 4
+
+typedef struct {
+    const char *mnemonic;
+    uint8_t operands[FORM_OPERANDS_MAX]; /* operand_kind_t */
+    uint8_t encoding;    /* operand_encoding_t */
+    uint8_t prefix;      /* mandatory 66, F2 or F3 prefix, or 0 */
+    uint8_t map;         /* opcode_map_t */
+    uint8_t opcode;
+    uint8_t digit;       /* ModRM.reg of ENC_M and ENC_MI */
+    uint8_t flags;       /* FORM_* */
+} instruction_form_t;
+
+extern const instruction_form_t INSTRUCTION_FORMS[];
+extern const size_t INSTRUCTION_FORMS_SIZE;
+
+/* xor r/m32, r32, the zero idiom, xor's forms come first in the table so
+   this index is fixed */
+#define FORM_ZERO_IDIOM 4
+
+typedef enum {
+    OPERAND_REGISTER,
+    OPERAND_MEMORY, /* [base + displacement] or [label + displacement] */
+    OPERAND_IMMEDIATE,
+    OPERAND_LABEL
+} operand_type_t;
+
+typedef enum {
+    REGISTER_R32, REGISTER_R64, REGISTER_XMM, REGISTER_YMM
+} register_class_t;
+
+/* a parsed operand */
+typedef struct {
+    uint8_t type;           /* operand_type_t */
+    uint8_t register_class; /* register_class_t of a register operand */
+    uint8_t reg;            /* register number, or the base of memory */
+    uint32_t label;         /* SYMBOL_NONE unless memory is rip relative */
+    int32_t displacement;
+    uint64_t immediate;
+} operand_t;
+
+/* returns the first form in [first, first + size) that takes the operands,
+   or -1 if none does */
+int32_t instruction_form_match(uint32_t first, uint32_t size,
+                               const operand_t *operands,
+                               size_t operands_size);
+
+/* returns the size in bytes of the immediate of the form */
+uint8_t instruction_form_immediate_size(const instruction_form_t *form);
+
+#endif
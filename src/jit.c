@@ -0,0 +1,112 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#define _GNU_SOURCE
+
+#include "jit.h"
+
+/* C */
+#include <errno.h>
+#include <string.h>
+
+/* POSIX */
+#include <sys/mman.h>
+#include <unistd.h>
+
+bool jit_map(jit_t *jit, size_t size, bool is_dual)
+{
+    memset(jit, 0, sizeof(*jit));
+    jit->fd = -1;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t map_size = (size + page_size - 1) & ~(page_size - 1);
+    jit->map_size = map_size != 0 ? map_size : page_size;
+    if (!is_dual) {
+        void *map = mmap(NULL, jit->map_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        jit->writable = map;
+        jit->executable = map;
+        return true;
+    }
+
+    jit->fd = memfd_create("eyl-jit", MFD_CLOEXEC);
+    if (jit->fd == -1) {
+        return false;
+    }
+    if (ftruncate(jit->fd, jit->map_size) == -1) {
+        goto close_fd;
+    }
+    void *writable = mmap(NULL, jit->map_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, jit->fd, 0);
+    if (writable == MAP_FAILED) {
+        goto close_fd;
+    }
+    void *executable = mmap(NULL, jit->map_size, PROT_READ | PROT_EXEC,
+                            MAP_SHARED, jit->fd, 0);
+    if (executable == MAP_FAILED) {
+        int error = errno;
+        munmap(writable, jit->map_size);
+        errno = error;
+        goto close_fd;
+    }
+    jit->writable = writable;
+    jit->executable = executable;
+    return true;
+
+ close_fd:
+    {
+        int error = errno;
+        close(jit->fd);
+        jit->fd = -1;
+        errno = error;
+    }
+    return false;
+}
+
+bool jit_seal(jit_t *jit)
+{
+    if (jit->fd == -1) {
+        if (mprotect(jit->writable, jit->map_size,
+                     PROT_READ | PROT_EXEC) == -1) {
+            return false;
+        }
+    }
+    else {
+        munmap(jit->writable, jit->map_size);
+        close(jit->fd);
+        jit->fd = -1;
+    }
+    jit->writable = NULL;
+    return true;
+}
+
+void jit_unmap(jit_t *jit)
+{
+    if (jit->writable != NULL && jit->writable != jit->executable) {
+        munmap(jit->writable, jit->map_size);
+    }
+    if (jit->executable != NULL) {
+        munmap((void *) jit->executable, jit->map_size);
+    }
+    if (jit->fd != -1) {
+        close(jit->fd);
+    }
+    memset(jit, 0, sizeof(*jit));
+    jit->fd = -1;
+}
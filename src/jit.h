@@ -0,0 +1,48 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef EYL_JIT_H
+#define EYL_JIT_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Executable memory for machine code assembled in this process. The code is
+   written through writable and then run from executable. With a single
+   mapping they are the same pages, which are flipped from read/write to
+   read/execute by jit_seal. With a dual mapping they are two views of one
+   memfd, the read/write view is unmapped by jit_seal, so no page is ever
+   writable and executable at once. */
+typedef struct {
+    uint8_t *writable;
+    const uint8_t *executable;
+    size_t map_size;
+    int fd; /* the memfd of a dual mapping, -1 otherwise */
+} jit_t;
+
+/* maps room for size bytes of code, returns false and sets errno if the
+   memory could not be mapped */
+bool jit_map(jit_t *jit, size_t size, bool is_dual);
+
+/* makes the written code executable and no longer writable */
+bool jit_seal(jit_t *jit);
+
+void jit_unmap(jit_t *jit);
+
+#endif
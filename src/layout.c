@@ -0,0 +1,146 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "layout.h"
+
+/* C */
+#include <string.h>
+
+/* POSIX */
+#include <elf.h>
+
+/* the text starts on the boundary compilers align functions to and .bss is
+   aligned for any scalar or vector, unless they ask for more */
+static const uint64_t SECTION_ALIGNMENTS[SECTIONS_SIZE] = {
+    [SECTION_TEXT] = 16,
+    [SECTION_RODATA] = 1,
+    [SECTION_DATA] = 1,
+    [SECTION_BSS] = 32
+};
+
+static const char *const SECTION_NAMES[SECTIONS_SIZE] = {
+    ".text", ".rodata", ".data", ".bss"
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t flags;
+} SECTION_HEADERS[SECTIONS_SIZE] = {
+    [SECTION_TEXT] = { SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR },
+    [SECTION_RODATA] = { SHT_PROGBITS, SHF_ALLOC },
+    [SECTION_DATA] = { SHT_PROGBITS, SHF_ALLOC | SHF_WRITE },
+    [SECTION_BSS] = { SHT_NOBITS, SHF_ALLOC | SHF_WRITE }
+};
+
+/* a layout has at most three segments and a section for each of them, the
+   builder can never be full */
+_Static_assert(ELF_SEGMENTS_CAPACITY >= 3
+               && ELF_SECTIONS_CAPACITY > SECTIONS_SIZE,
+               "the ELF builder has no room for every section");
+
+static void set_alignments(layout_t *layout, const uint64_t *alignments)
+{
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        layout->sections[s].alignment = alignments[s] > SECTION_ALIGNMENTS[s]
+            ? alignments[s] : SECTION_ALIGNMENTS[s];
+    }
+}
+
+static void add_section(layout_t *layout, section_t s, const uint64_t *sizes,
+                        size_t segment)
+{
+    layout->elf_sections[s] =
+        elf_builder_add_section(&layout->elf, SECTION_NAMES[s],
+                                SECTION_HEADERS[s].type,
+                                SECTION_HEADERS[s].flags,
+                                layout->sections[s].alignment, sizes[s],
+                                segment);
+}
+
+/* copies where the builder placed each section, a section the file does
+   not have is empty and starts where the section before it ends */
+static void copy_sections(layout_t *layout)
+{
+    const elf_builder_t *elf = &layout->elf;
+    uint64_t offset = elf->headers_size;
+    uint64_t address = elf->base_address + offset;
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        section_layout_t *section = &layout->sections[s];
+        size_t index = layout->elf_sections[s];
+        if (index == 0) {
+            section->offset = offset;
+            section->address = address;
+            section->size = 0;
+            continue;
+        }
+        section->offset = elf->sections[index].offset;
+        section->address = elf->sections[index].address;
+        section->size = elf->sections[index].size;
+        offset = section->offset;
+        if (elf->sections[index].type != SHT_NOBITS) {
+            offset += section->size;
+        }
+        address = section->address + section->size;
+    }
+    layout->headers_size = elf->headers_size;
+    layout->file_size = elf->loaded_size;
+}
+
+void layout_sections(layout_t *layout, const uint64_t *sizes,
+                     const uint64_t *alignments, uint64_t text_alignment)
+{
+    memset(layout, 0, sizeof(*layout));
+    set_alignments(layout, alignments);
+    elf_builder_t *elf = &layout->elf;
+    elf_builder_init(elf, ET_EXEC, LAYOUT_BASE_ADDRESS);
+
+    /* a huge page of text is not shared with the segment after it */
+    size_t text = elf_builder_add_segment(elf, PF_R | PF_X, text_alignment);
+    add_section(layout, SECTION_TEXT, sizes, text);
+    if (sizes[SECTION_RODATA] != 0) {
+        size_t rodata = elf_builder_add_segment(elf, PF_R, LAYOUT_PAGE_SIZE);
+        add_section(layout, SECTION_RODATA, sizes, rodata);
+    }
+    if (sizes[SECTION_DATA] != 0 || sizes[SECTION_BSS] != 0) {
+        size_t data = elf_builder_add_segment(elf, PF_R | PF_W,
+                                              LAYOUT_PAGE_SIZE);
+        if (sizes[SECTION_DATA] != 0) {
+            add_section(layout, SECTION_DATA, sizes, data);
+        }
+        if (sizes[SECTION_BSS] != 0) {
+            add_section(layout, SECTION_BSS, sizes, data);
+        }
+    }
+    elf_builder_layout(elf);
+    copy_sections(layout);
+}
+
+void layout_object(layout_t *layout, const uint64_t *sizes,
+                   const uint64_t *alignments)
+{
+    memset(layout, 0, sizeof(*layout));
+    set_alignments(layout, alignments);
+    elf_builder_init(&layout->elf, ET_REL, 0);
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        add_section(layout, s, sizes, ELF_NO_SEGMENT);
+    }
+    elf_builder_layout(&layout->elf);
+    copy_sections(layout);
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        layout->sections[s].address = s * LAYOUT_SECTION_SPACING;
+    }
+}
@@ -0,0 +1,80 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef EYL_LAYOUT_H
+#define EYL_LAYOUT_H
+
+/* C */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "elf/builder.h"
+
+/* Where each section of an executable goes in the file and in memory. The
+   text segment starts at the beginning of the file so it also maps the ELF
+   and program headers, read only data and writable data each get their own
+   segment when they are not empty, and .bss follows .data in the writable
+   segment without taking any room in the file. The ELF builder places
+   them, the section headers for the symbols are added to a copy of it. */
+
+#define LAYOUT_BASE_ADDRESS 0x400000
+#define LAYOUT_PAGE_SIZE 4096
+#define LAYOUT_HUGE_PAGE_SIZE (2 << 20)
+/* how far apart sections are in an object file, where each starts at
+   section * LAYOUT_SECTION_SPACING */
+#define LAYOUT_SECTION_SPACING ((uint64_t) 1 << 60)
+
+typedef enum {
+    SECTION_TEXT,
+    SECTION_RODATA,
+    SECTION_DATA,
+    SECTION_BSS
+} section_t;
+#define SECTIONS_SIZE 4
+
+typedef struct {
+    uint64_t address;
+    uint64_t offset; /* in the file, where .bss would be for .bss */
+    uint64_t size;
+    uint64_t alignment;
+} section_layout_t;
+
+typedef struct {
+    section_layout_t sections[SECTIONS_SIZE];
+    elf_builder_t elf;
+    /* the index of each section in elf, 0 if the file does not have it */
+    size_t elf_sections[SECTIONS_SIZE];
+    uint64_t headers_size; /* the ELF header and the program headers */
+    uint64_t file_size; /* up to the end of the last segment */
+} layout_t;
+
+/* lays out sections of the given sizes, each starts at a multiple of its
+   alignment (a power of two up to the page size) or more, the text segment
+   (and so the start of the text) is aligned to text_alignment, which is a
+   multiple of the page size, and every later segment starts on a new page.
+   Where the text starts only depends on which sections are empty and the
+   alignment of the text. */
+void layout_sections(layout_t *layout, const uint64_t *sizes,
+                     const uint64_t *alignments, uint64_t text_alignment);
+
+/* lays out an object file of sections of the given sizes, which has no
+   program headers and no segments, every section is placed after the ELF
+   header at its own address so the linker can move it */
+void layout_object(layout_t *layout, const uint64_t *sizes,
+                   const uint64_t *alignments);
+
+#endif
@@ -0,0 +1,260 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "literal.h"
+
+/* C */
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Every literal is parsed in two steps. The digits are counted first, 16
+   bytes at a time with SSE2 and 8 at a time in a register, which after
+   skipping leading zeros is enough to know if the value overflows: it
+   always does with more than 20 decimal, 16 hexadecimal or 64 binary
+   digits, and only the twentieth decimal digit needs a checked multiply.
+   The counted digits are then converted 8 at a time with SWAR (SIMD within
+   a register), which needs no checks since they are known to be digits. A
+   decimal literal of fewer than 8 digits, the most common kind, is done
+   after looking at its first 8 bytes once. */
+
+typedef enum { BASE_BINARY, BASE_DECIMAL, BASE_HEXADECIMAL } base_t;
+
+static bool is_digit(uint8_t c, base_t base)
+{
+    switch (base) {
+    case BASE_BINARY:
+        return c == '0' || c == '1';
+    case BASE_DECIMAL:
+        return c >= '0' && c <= '9';
+    default:
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')
+            || (c >= 'A' && c <= 'F');
+    }
+}
+
+#if defined(__x86_64__)
+
+/* bytes in [lo, hi] have their bit set, see scan.c */
+#define SSE2_IN_RANGE(x, lo, hi)                                              \
+    _mm_cmplt_epi8(_mm_add_epi8(x, _mm_set1_epi8((char) (0x80 - (lo)))),     \
+                   _mm_set1_epi8((char) (-128 + (hi) - (lo) + 1)))
+
+/* returns a bit for each of the 16 bytes at start that is a digit */
+static unsigned digit_mask(const char *start, base_t base)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *) start);
+    __m128i digit;
+    switch (base) {
+    case BASE_BINARY:
+        digit = SSE2_IN_RANGE(x, '0', '1');
+        break;
+    case BASE_DECIMAL:
+        digit = SSE2_IN_RANGE(x, '0', '9');
+        break;
+    default:
+        digit = _mm_or_si128(
+            SSE2_IN_RANGE(x, '0', '9'),
+            _mm_or_si128(SSE2_IN_RANGE(x, 'a', 'f'),
+                         SSE2_IN_RANGE(x, 'A', 'F')));
+        break;
+    }
+    return _mm_movemask_epi8(digit);
+}
+
+#endif
+
+static uint64_t load(const char *start)
+{
+    uint64_t bytes;
+    memcpy(&bytes, start, sizeof(bytes));
+    return bytes;
+}
+
+/* returns how many of the 8 bytes at start are decimal digits before the
+   first one that is not, a byte is one if its high nibble is 3 and adding
+   6 to its low nibble does not carry into the high nibble */
+static size_t decimal_digits_8(const char *start)
+{
+    uint64_t x = load(start);
+    uint64_t other = ((x & 0xf0f0f0f0f0f0f0f0) ^ 0x3030303030303030)
+        | (((x & 0x0f0f0f0f0f0f0f0f) + 0x0606060606060606)
+           & 0xf0f0f0f0f0f0f0f0);
+    return other == 0 ? 8 : __builtin_ctzll(other) / 8;
+}
+
+/* returns the end of the digits at start */
+static const char *digits_end(const char *start, const char *end,
+                              base_t base)
+{
+#if defined(__x86_64__)
+    while (end - start >= 16) {
+        unsigned mask = ~digit_mask(start, base) & 0xffff;
+        if (mask != 0) {
+            return start + __builtin_ctz(mask);
+        }
+        start += 16;
+    }
+#endif
+    if (base == BASE_DECIMAL && end - start >= 8) {
+        size_t size = decimal_digits_8(start);
+        start += size;
+        if (size < 8) {
+            return start;
+        }
+    }
+    while (start != end && is_digit(*start, base)) {
+        ++start;
+    }
+    return start;
+}
+
+/* the value of the 8 decimal digits at start, the first is the most
+   significant and so the lowest byte */
+static uint64_t decimal_8(const char *start)
+{
+    uint64_t x = load(start) - 0x3030303030303030;
+    x = (x * 10 + (x >> 8)) & 0x00ff00ff00ff00ff;
+    x = (x * 100 + (x >> 16)) & 0x0000ffff0000ffff;
+    return (x * 10000 + (x >> 32)) & 0xffffffff;
+}
+
+/* the value of the 8 hexadecimal digits at start, a letter is 9 more than
+   its low nibble */
+static uint64_t hexadecimal_8(const char *start)
+{
+    uint64_t x = load(start);
+    x = (x & 0x0f0f0f0f0f0f0f0f) + ((x >> 6) & 0x0101010101010101) * 9;
+    /* the last digit is the least significant */
+    x = __builtin_bswap64(x);
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ff;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffff;
+    return (x | (x >> 16)) & 0xffffffff;
+}
+
+/* the value of the 8 binary digits at start, the multiply moves the low
+   bit of byte i to bit 63 - i and nothing carries into the top byte */
+static uint64_t binary_8(const char *start)
+{
+    uint64_t x = load(start) & 0x0101010101010101;
+    return (x * 0x8040201008040201) >> 56;
+}
+
+static uint64_t digit_value(uint8_t c)
+{
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+/* converts the digits in [start, last), which has no more than the most
+   digits a value can have after its leading zeros */
+static literal_status_t convert(const char *start, const char *last,
+                                base_t base, uint64_t *value)
+{
+    uint64_t result = 0;
+    if (base == BASE_DECIMAL) {
+        /* 19 digits always fit */
+        const char *checked = last - start == 20 ? last - 1 : last;
+        for (; checked - start >= 8; start += 8) {
+            result = result * 100000000 + decimal_8(start);
+        }
+        for (; start != checked; ++start) {
+            result = result * 10 + (*start - '0');
+        }
+        if (start != last
+            && (__builtin_mul_overflow(result, 10, &result)
+                || __builtin_add_overflow(result, *start - '0', &result))) {
+            return LITERAL_OVERFLOW;
+        }
+    }
+    else {
+        unsigned shift = base == BASE_HEXADECIMAL ? 4 : 1;
+        for (; last - start >= 8; start += 8) {
+            uint64_t digits_8 = base == BASE_HEXADECIMAL ? hexadecimal_8(start)
+                                                         : binary_8(start);
+            /* a shift by 64 is undefined, so by 32 twice */
+            result = (result << (shift * 4)) << (shift * 4) | digits_8;
+        }
+        for (; start != last; ++start) {
+            result = result << shift | digit_value(*start);
+        }
+    }
+    *value = result;
+    return LITERAL_OK;
+}
+
+literal_status_t literal_parse(const char *start, const char *end,
+                               uint64_t *value, const char **literal_end)
+{
+    static const size_t MAX_DIGITS[] = {
+        [BASE_BINARY] = 64, [BASE_DECIMAL] = 20, [BASE_HEXADECIMAL] = 16
+    };
+
+    base_t base = BASE_DECIMAL;
+    if (end - start >= 2 && start[0] == '0') {
+        if (start[1] == 'x' || start[1] == 'X') {
+            base = BASE_HEXADECIMAL;
+            start += 2;
+        }
+        else if (start[1] == 'b' || start[1] == 'B') {
+            base = BASE_BINARY;
+            start += 2;
+        }
+    }
+
+    /* most literals are short decimal ones, which cannot overflow */
+    const char *digits = start;
+    const char *checked = start;
+    if (base == BASE_DECIMAL) {
+        size_t size = 0;
+        if (end - start >= 8) {
+            size = decimal_digits_8(start);
+        }
+        else {
+            while (start + size != end && is_digit(start[size], base)) {
+                ++size;
+            }
+        }
+        if (size < 8) {
+            *literal_end = start + size;
+            if (size == 0) {
+                return LITERAL_EMPTY;
+            }
+            uint64_t result = 0;
+            for (size_t i = 0; i < size; ++i) {
+                result = result * 10 + (start[i] - '0');
+            }
+            *value = result;
+            return LITERAL_OK;
+        }
+        checked += 8;
+    }
+
+    const char *last = digits_end(checked, end, base);
+    *literal_end = last;
+    if (last == digits) {
+        return LITERAL_EMPTY;
+    }
+    while (start != last && *start == '0') {
+        ++start;
+    }
+    if ((size_t) (last - start) > MAX_DIGITS[base]) {
+        return LITERAL_OVERFLOW;
+    }
+    return convert(start, last, base, value);
+}
@@ -0,0 +1,45 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_LITERAL_H
+#define EYL_LITERAL_H
+
+/* C */
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    LITERAL_OK,
+    LITERAL_EMPTY,   /* no digits */
+    LITERAL_OVERFLOW /* the value does not fit in 64 bits */
+} literal_status_t;
+
+/* Parses the unsigned integer literal at start, which ends before end:
+   decimal digits, or hexadecimal digits after 0x or 0X, or binary digits
+   after 0b or 0B. It stops at the first byte that is not a digit of its
+   base and sets *literal_end to it, even if the literal overflows, and
+   only sets *value if it returns LITERAL_OK. */
+literal_status_t literal_parse(const char *start, const char *end,
+                               uint64_t *value, const char **literal_end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -14,259 +14,797 @@ You should have received a copy of the GNU General Public License along with
 this program. If not, see <http://www.gnu.org/licenses/>.
 *******************************************************************************/
 
+#define _GNU_SOURCE
+
 /* C */
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /* POSIX */
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-/* ELF */
-#include <elf.h>
+#include "assembler.h"
+#include "cache.h"
+#include "jit.h"
+#include "scan.h"
+#include "symbols.h"
 
-typedef enum { STA_MNEMONIC, STA_REGISTER, STA_NUMBER } global_state_t;
+/* machine code of at least this size is encoded straight into the mapped
+   output file */
+#define MMAP_OUTPUT_MIN_SIZE (1 << 20)
 
-typedef enum { MNE_MOV, MNE_SYSCALL } mnemonic_id_t;
-typedef struct {
-    char *name;
-    mnemonic_id_t id;
-} mnemonic_info_t;
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
 
-static const mnemonic_info_t MNEMONIC_INFO[] = {
-    { "mov", MNE_MOV },
-    { "syscall", MNE_SYSCALL }
-};
-#define MNEMONIC_INFO_SIZE (sizeof MNEMONIC_INFO / sizeof MNEMONIC_INFO[0])
+static void list_code(FILE *listing, const uint8_t *bytes, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        fprintf(listing, " %02x", bytes[i]);
+    }
+}
 
-typedef enum { REG_RAX, REG_RDI } reg_id_t;
-typedef struct {
-    char *name;
-    reg_id_t id;
-} register_info_t;
+/* lists the bytes of every section in the file */
+static void list_sections(FILE *listing, const assembly_t *assembly)
+{
+    static const char *const NAMES[SECTION_BSS] = {
+        ".text", ".rodata", ".data"
+    };
+    for (size_t s = 0; s < SECTION_BSS; ++s) {
+        uint64_t size = assembly->layout.sections[s].size;
+        if (s != SECTION_TEXT && size == 0) {
+            continue;
+        }
+        fprintf(listing, "\ngenerated %" PRIu64 " bytes of %s\n", size,
+                NAMES[s]);
+        list_code(listing, assembly->section_bytes[s], size);
+        fprintf(listing, "\n");
+    }
+}
 
-static const register_info_t REGISTER_INFO[] = {
-    { "rax", REG_RAX },
-    { "rdi", REG_RDI }
-};
-#define REGISTER_INFO_SIZE (sizeof MNEMONIC_INFO / sizeof MNEMONIC_INFO[0])
+/* stores the output file unless cache is NULL, failing to store only costs
+   the next run a miss */
+static void store_output(cache_t *cache, uint64_t key, uint64_t input_size,
+                         const struct iovec *iov, size_t iov_size)
+{
+    if (cache == NULL) {
+        return;
+    }
+    if (!cache_store(cache, key, input_size, iov, iov_size)) {
+        perror("storing cache entry");
+    }
+}
 
-int main(int argc, char **argv)
+/* The whole file is built in one buffer and written at once. Large outputs
+   are sized with ftruncate and mapped, so the buffer is the file's pages
+   and there is nothing left to write, smaller outputs or outputs that
+   cannot be mapped (pipes) are built in memory and written with one call.
+   The ELF builder writes the headers and the symbols, every job encodes
+   its code straight into its section. The whole file is also stored as the
+   entry for key if cache is not NULL. */
+static bool write_output(int fd, assembly_t *assembly, cache_t *cache,
+                         uint64_t key, uint64_t input_size)
 {
-    if (argc != 4) {
-        return EXIT_FAILURE;
+    bool is_written = false;
+    bool is_mapped = false;
+    uint8_t *image = NULL;
+    symbols_t symbols;
+    symbols_init(&symbols);
+    elf_builder_t elf = assembly->layout.elf;
+    if (!symbols_collect(&symbols, assembly)
+        || !symbols_encode(&symbols, assembly, &elf)) {
+        perror("encoding symbols");
+        goto free_symbols;
     }
-    int ret = EXIT_SUCCESS;
-    if (strcmp("-o", argv[2]) != 0) {
-        return EXIT_FAILURE;
+    elf_builder_layout(&elf);
+    elf.entry = assembly->entry;
+
+    size_t file_size = elf.file_size;
+    if (file_size >= MMAP_OUTPUT_MIN_SIZE
+        && ftruncate(fd, file_size) == 0) {
+        image = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     0);
+        is_mapped = image != MAP_FAILED;
+        if (!is_mapped) {
+            image = NULL;
+        }
     }
-    int fd = open(argv[1], O_RDONLY);
-    if (fd == -1) {
-        perror("opening input file");
-        ret = EXIT_FAILURE;
-        goto ret;
+    if (image == NULL) {
+        image = malloc(file_size);
+        if (image == NULL) {
+            perror("allocating output file");
+            goto free_symbols;
+        }
+    }
+    elf_builder_write(&elf, image);
+    if (!assembly_encode(assembly, image)) {
+        goto free_image;
+    }
+    if (assembly->listing != NULL) {
+        list_sections(assembly->listing, assembly);
     }
 
-    size_t input_size;
-    {
-        struct stat stat;
-        if (fstat(fd, &stat) == -1) {
-            perror("stating input file");
-            ret = EXIT_FAILURE;
-            goto close_fd;
-        }
-        input_size = stat.st_size;
+    struct iovec iov = { image, file_size };
+    store_output(cache, key, input_size, &iov, 1);
+    if (!is_mapped && !elf_write_all(fd, &iov, 1)) {
+        perror("writing output file");
+        goto free_image;
+    }
+    is_written = true;
+
+ free_image:
+    if (is_mapped) {
+        munmap(image, file_size);
     }
+    else {
+        free(image);
+    }
+ free_symbols:
+    symbols_fini(&symbols);
+    return is_written;
+}
+
+/* writes the output file of a cache entry, the input is never parsed */
+static bool write_cached_output(int fd, const cache_entry_t *entry)
+{
+    struct iovec iov = { (void *) entry->output, entry->output_size };
+    if (!elf_write_all(fd, &iov, 1)) {
+        perror("writing output file");
+        return false;
+    }
+    return true;
+}
 
-    char *input = mmap(NULL, input_size, PROT_READ, MAP_PRIVATE, fd, 0);
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-j threads] [--listing] [--stats] [--cache directory]"
+            " [--huge-pages] [-c] [--align-loops[=bytes]] input -o output\n"
+            "       %s [-j threads] [--listing] [--stats] [--cache directory]"
+            " [--huge-pages] [-c] [--align-loops[=bytes]] --batch manifest\n"
+            "       %s [-j threads] [--listing] [--stats] [--perf-map]"
+            " [--align-loops[=bytes]] --run[=mprotect|memfd] input\n",
+            program, program, program);
+}
+
+static void print_stats(const assembly_t *assembly, const cache_t *cache,
+                        double mmap_seconds, double write_seconds,
+                        uint64_t input_size)
+{
+    double encode_seconds = assembly->encode_seconds;
+    double total_seconds = mmap_seconds + assembly->parse_seconds
+        + assembly->layout_seconds + write_seconds;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "mmap         %12.6f s\n", mmap_seconds);
+    fprintf(stderr, "tokenize     %12.6f s\n", assembly->parse_seconds);
+    fprintf(stderr, "layout       %12.6f s\n", assembly->layout_seconds);
+    fprintf(stderr, "encode       %12.6f s\n", encode_seconds);
+    fprintf(stderr, "elf write    %12.6f s\n", write_seconds - encode_seconds);
+    fprintf(stderr, "total        %12.6f s\n", total_seconds);
+    if (assembly->tokens_size > 0) {
+        fprintf(stderr, "tokens       %12" PRIu64 " (%.0f tokens/s)\n",
+                assembly->tokens_size,
+                assembly->tokens_size / assembly->parse_seconds);
+    }
+    fprintf(stderr, "input        %12" PRIu64 " bytes (%.0f bytes/s)\n",
+            input_size, input_size / total_seconds);
+    uint64_t output_size = assembly->layout.file_size;
+    fprintf(stderr, "output       %12" PRIu64 " bytes (%.0f bytes/s)\n",
+            output_size, output_size / total_seconds);
+    fprintf(stderr, "peak memory  %12ld KiB\n", usage.ru_maxrss);
+    if (cache != NULL) {
+        fprintf(stderr, "cache        %12" PRIu64 " hits %" PRIu64
+                " misses\n", cache->hits, cache->misses);
+    }
+}
+
+/* how every input is assembled */
+typedef struct {
+    long threads;
+    FILE *listing; /* NULL unless a listing was asked for */
+    bool is_stats;
+    uint64_t text_alignment; /* of the text segment in the output file */
+    bool is_relocatable; /* the output is an object file */
+    uint64_t loop_alignment; /* of loop heads, 0 if they are not aligned */
+} options_t;
+
+/* returns the contents of the file mapped read only, or NULL if it could
+   not be mapped */
+static char *map_input(const char *path, size_t *size)
+{
+    char *input = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("opening input file");
+        return NULL;
+    }
+    struct stat stat;
+    if (fstat(fd, &stat) == -1) {
+        perror("stating input file");
+        goto close_fd;
+    }
+    *size = stat.st_size;
+    input = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
     if (input == MAP_FAILED) {
         perror("mmap input file");
-        ret = EXIT_FAILURE;
-        goto close_fd;
+        input = NULL;
     }
 
-    char *current = input;
-    char *input_end = input + input_size;
+ close_fd:
+    close(fd);
+    return input;
+}
 
-    size_t machine_code_capacity = 4096;
-    uint8_t *machine_code = malloc(machine_code_capacity);
-    if (machine_code == NULL) {
-        perror("malloc machine code");
-        ret = EXIT_FAILURE;
+/* assembles the input file into the output file with assembly, looking the
+   input up in cache first unless it is NULL */
+static bool assemble_file(assembly_t *assembly, cache_t *cache,
+                          const options_t *options, const char *input_path,
+                          const char *output_path)
+{
+    bool is_assembled = false;
+    double start = now();
+    size_t input_size;
+    char *input = map_input(input_path, &input_size);
+    if (input == NULL) {
+        return false;
+    }
+    double mmap_seconds = now() - start;
+
+    uint64_t key = 0;
+    cache_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    bool is_cached = false;
+    if (cache != NULL) {
+        /* the loop alignment is at most the page size, so every option
+           has its own bits */
+        key = cache_key(cache, input, input_size,
+                        options->text_alignment << 16
+                        | options->loop_alignment << 1
+                        | options->is_relocatable);
+        is_cached = cache_lookup(cache, key, input_size, &entry);
+        assembly->layout.file_size = entry.output_size;
+    }
+    assembly->text_alignment = options->text_alignment;
+    assembly->is_relocatable = options->is_relocatable;
+    assembly->loop_alignment = options->loop_alignment;
+    if (!is_cached
+        && !assembly_parse(assembly, input, input_size, options->threads,
+                           options->listing)) {
+        fwrite(assembly->diagnostics, 1, assembly->diagnostics_size, stderr);
         goto unmap_input;
     }
-    uint8_t *machine_code_current = machine_code;
-    /* TODO - make machine_code realloc if it runs out of capacity */
-
-    char *start = NULL;
-    global_state_t state = STA_MNEMONIC;
-    bool is_valid = false;
-    while (current != input_end) {
-        switch (state) {
-        case STA_MNEMONIC:
-        case STA_REGISTER:
-            is_valid = *current >= 'a' && *current <= 'z';
-            break;
-        case STA_NUMBER:
-            is_valid = *current >= '0' && *current <= '9';
-        }
 
-        if (is_valid && start == NULL) {
-            start = current;
-        }
+    /* the input stays mapped until the output is written since the label
+       names in its symbol table point into it */
+    mode_t mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+    if (options->is_relocatable) {
+        mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    }
+    int output_fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, mode);
+    if (output_fd == -1) {
+        perror("opening output file");
+        goto unmap_input;
+    }
+    start = now();
+    is_assembled = is_cached
+        ? write_cached_output(output_fd, &entry)
+        : write_output(output_fd, assembly, cache, key, input_size);
+    close(output_fd);
+    if (!is_assembled && !is_cached) {
+        fwrite(assembly->diagnostics, 1, assembly->diagnostics_size, stderr);
+    }
+    if (is_assembled && options->is_stats) {
+        print_stats(assembly, cache, mmap_seconds, now() - start,
+                    input_size);
+    }
 
-        else if (!is_valid && start != NULL) {
-            size_t size = current - start;
-
-            switch (state) {
-            case STA_MNEMONIC:
-                for (size_t i = 0; i < MNEMONIC_INFO_SIZE; ++i) {
-                    char *name = MNEMONIC_INFO[i].name;
-                    if (size == strlen(name)
-                        && (strncmp(name, start, size) == 0)) {
-
-
-                        switch (MNEMONIC_INFO[i].id) {
-                        case MNE_MOV:
-                            state = STA_REGISTER;
-                            *machine_code_current = 0x48;
-                            ++machine_code_current;
-                            *machine_code_current = 0xc7;
-                            ++machine_code_current;
-                            break;
-                        case MNE_SYSCALL:
-                            *machine_code_current = 0x0f;
-                            ++machine_code_current;
-                            *machine_code_current = 0x05;
-                            ++machine_code_current;
-                            break;
-                        }
-
-                        printf("%s mnemonic\n", name);
-                        break;
-                    }
-                }
-                break;
-            case STA_REGISTER:
-
-                for (size_t i = 0; i < REGISTER_INFO_SIZE; ++i) {
-                    char *name = REGISTER_INFO[i].name;
-                    if (size == strlen(name)
-                        && (strncmp(name, start, size) == 0)) {
-
-                        switch (REGISTER_INFO[i].id) {
-                        case REG_RAX:
-                            *machine_code_current = 0xc0;
-                            ++machine_code_current;
-                            break;
-                        case REG_RDI:
-                            *machine_code_current = 0xc7;
-                            ++machine_code_current;
-                            break;
-                        }
-                        state = STA_NUMBER;
-                        printf("%s register\n", name);
-                        break;
-                    }
-                }
-                break;
-            case STA_NUMBER:
-                {
-                    uint32_t number = 0;
-                    for (size_t i = 0; i < size; ++i) {
-                        number *= 10;
-                        number += *(start + i) - '0';
-                    }
-
-                    *((uint32_t*) machine_code_current) = number;
-                    machine_code_current += 4;
-                    printf("%d number\n", number);
-                }
-                state = STA_MNEMONIC;
-                break;
-            }
+ unmap_input:
+    cache_entry_fini(&entry);
+    munmap(input, input_size);
+    return is_assembled;
+}
 
-            start = NULL;
+/* Writes /tmp/perf-<pid>.map, where perf looks up the symbols of code that
+   is not in any file, with a line for every label in the text mapped at
+   executable. */
+static bool write_perf_map(const assembly_t *assembly,
+                           const uint8_t *executable)
+{
+    bool is_written = false;
+    symbols_t symbols;
+    symbols_init(&symbols);
+    if (!symbols_collect(&symbols, assembly)) {
+        goto free_symbols;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%ld.map", (long) getpid());
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        goto free_symbols;
+    }
+    for (size_t i = 0; i < symbols.symbols_size; ++i) {
+        const label_symbol_t *symbol = &symbols.symbols[i];
+        if (symbol->section != SECTION_TEXT) {
+            continue;
         }
-        ++current;
+        const symbol_t *label = &assembly->labels.symbols[symbol->label];
+        uintptr_t start = (uintptr_t) executable
+            + (symbol->address - LAYOUT_BASE_ADDRESS);
+        fprintf(file, "%" PRIxPTR " %" PRIx64 " %.*s\n", start, symbol->size,
+                (int) label->name_size, label->name);
     }
-    /* need to check here as well */
-    /* in case the file doesn't end with whitespace (newline) */
-    if (start != NULL) {
-        // TODO
+    is_written = fclose(file) == 0;
+
+ free_symbols:
+    symbols_fini(&symbols);
+    return is_written;
+}
+
+/* Assembles the input straight into executable memory and calls it. The
+   memory holds the file image with the sections at their file offsets, so
+   rip relative references to .rodata still reach, but it is never writable
+   once it runs. The program usually ends with an exit syscall, if it
+   returns instead the low byte of rax is the exit status. With stats the
+   time from starting to read the input until the first instruction runs is
+   printed first. */
+static int run_file(assembly_t *assembly, const options_t *options,
+                    const char *input_path, bool is_dual_mapped,
+                    bool is_perf_map)
+{
+    int ret = EXIT_FAILURE;
+    double start = now();
+    size_t input_size;
+    char *input = map_input(input_path, &input_size);
+    if (input == NULL) {
+        return EXIT_FAILURE;
+    }
+    assembly->loop_alignment = options->loop_alignment;
+    if (!assembly_parse(assembly, input, input_size, options->threads,
+                        options->listing)) {
+        fwrite(assembly->diagnostics, 1, assembly->diagnostics_size, stderr);
+        goto unmap_input;
+    }
+    const layout_t *layout = &assembly->layout;
+    if (layout->sections[SECTION_DATA].size != 0
+        || layout->sections[SECTION_BSS].size != 0) {
+        fprintf(stderr, "--run does not support .data or .bss\n");
+        goto unmap_input;
+    }
+
+    jit_t jit;
+    if (!jit_map(&jit, layout->file_size, is_dual_mapped)) {
+        perror("mapping executable memory");
+        goto unmap_input;
+    }
+    if (!assembly_encode(assembly, jit.writable)) {
+        fwrite(assembly->diagnostics, 1, assembly->diagnostics_size, stderr);
+        goto unmap_jit;
+    }
+    if (!jit_seal(&jit)) {
+        perror("making memory executable");
+        goto unmap_jit;
+    }
+    /* the label names point into the input, which is still mapped */
+    if (is_perf_map && !write_perf_map(assembly, jit.executable)) {
+        perror("writing perf map");
     }
 
-    size_t machine_code_size = machine_code_current - machine_code;
-    printf("\ngenerated %ld bytes\n", machine_code_size);
-    for (size_t i = 0; i < machine_code_size; ++i) {
-        printf(" %02x", machine_code[i]);
+    uint64_t (*entry)(void);
+    *(void **) &entry = (void *) (jit.executable
+                                  + (assembly->entry - LAYOUT_BASE_ADDRESS));
+    if (options->is_stats) {
+        fprintf(stderr, "first insn   %12.6f s\n", now() - start);
     }
-    printf("\n");
+    fflush(stdout);
+    ret = entry() & 0xff;
 
-    free(machine_code);
+ unmap_jit:
+    jit_unmap(&jit);
  unmap_input:
     munmap(input, input_size);
- close_fd:
-    close(fd);
+    return ret;
+}
+
+typedef struct {
+    char *line; /* owns both paths */
+    const char *input_path;
+    const char *output_path;
+} batch_entry_t;
 
-    if (ret == EXIT_FAILURE) {
-        goto ret;
+/* The manifest's inputs are handed out to the workers one at a time, each
+   worker keeps its own assembly (and cache counters) across inputs. */
+typedef struct {
+    batch_entry_t *entries;
+    size_t entries_size;
+    atomic_size_t next;
+    const options_t *options;
+    const cache_t *cache; /* NULL if there is no cache */
+} batch_t;
+
+typedef struct {
+    batch_t *batch;
+    assembly_t assembly;
+    cache_t cache;
+    size_t failed_size;
+    bool is_started;
+    pthread_t thread;
+} batch_worker_t;
+
+static void batch_fini(batch_t *batch)
+{
+    for (size_t i = 0; i < batch->entries_size; ++i) {
+        free(batch->entries[i].line);
     }
+    free(batch->entries);
+}
 
-    mode_t mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-    fd = open(argv[3], O_WRONLY | O_CREAT, mode);
-    if (fd == -1) {
-        perror("opening output file");
+static char *skip_space(char *current)
+{
+    while (*current == ' ' || *current == '\t') {
+        ++current;
+    }
+    return current;
+}
+
+static char *skip_path(char *current)
+{
+    while (*current != '\0' && *current != ' ' && *current != '\t'
+           && *current != '\n') {
+        ++current;
+    }
+    return current;
+}
+
+/* reads "input output" lines from the manifest (standard input if the path
+   is -), blank lines and lines starting with # are skipped */
+static bool read_manifest(batch_t *batch, const char *path)
+{
+    memset(batch, 0, sizeof(*batch));
+    bool is_read = false;
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL) {
+        perror("opening manifest");
+        return false;
+    }
+
+    size_t entries_capacity = 0;
+    size_t line_number = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, file) != -1) {
+        ++line_number;
+        char *input_path = skip_space(line);
+        if (*input_path == '\n' || *input_path == '\0'
+            || *input_path == '#') {
+            continue;
+        }
+        char *input_end = skip_path(input_path);
+        char *output_path = skip_space(input_end);
+        char *output_end = skip_path(output_path);
+        char *rest = skip_space(output_end);
+        if (output_path == input_end || output_path == output_end
+            || (*rest != '\n' && *rest != '\0')) {
+            fprintf(stderr, "%s:%zu: expected an input and an output path\n",
+                    path, line_number);
+            goto free_line;
+        }
+        *input_end = '\0';
+        *output_end = '\0';
+
+        if (batch->entries_size == entries_capacity) {
+            entries_capacity = entries_capacity ? entries_capacity * 2 : 64;
+            batch_entry_t *entries =
+                realloc(batch->entries,
+                        entries_capacity * sizeof(*entries));
+            if (entries == NULL) {
+                perror("allocating manifest");
+                goto free_line;
+            }
+            batch->entries = entries;
+        }
+        batch_entry_t *entry = &batch->entries[batch->entries_size++];
+        entry->line = line;
+        entry->input_path = input_path;
+        entry->output_path = output_path;
+        line = NULL;
+        line_capacity = 0;
+    }
+    if (ferror(file)) {
+        perror("reading manifest");
+        goto free_line;
+    }
+    is_read = true;
+
+ free_line:
+    free(line);
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!is_read) {
+        batch_fini(batch);
+    }
+    return is_read;
+}
+
+static void *batch_work(void *arg)
+{
+    batch_worker_t *worker = arg;
+    batch_t *batch = worker->batch;
+    cache_t *cache = batch->cache != NULL ? &worker->cache : NULL;
+    while (true) {
+        size_t i = atomic_fetch_add(&batch->next, 1);
+        if (i >= batch->entries_size) {
+            break;
+        }
+        batch_entry_t *entry = &batch->entries[i];
+        if (!assemble_file(&worker->assembly, cache, batch->options,
+                           entry->input_path, entry->output_path)) {
+            fprintf(stderr, "%s: assembling failed\n", entry->input_path);
+            ++worker->failed_size;
+        }
+    }
+    return NULL;
+}
+
+static void print_batch_stats(size_t files_size, size_t failed_size,
+                              double seconds, const cache_t *cache)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "files        %12zu (%.0f files/s)\n", files_size,
+            files_size / seconds);
+    fprintf(stderr, "failed       %12zu\n", failed_size);
+    fprintf(stderr, "total        %12.6f s\n", seconds);
+    fprintf(stderr, "peak memory  %12ld KiB\n", usage.ru_maxrss);
+    if (cache != NULL) {
+        fprintf(stderr, "cache        %12" PRIu64 " hits %" PRIu64
+                " misses\n", cache->hits, cache->misses);
+    }
+}
+
+/* Assembles every pair in the manifest in this process. With more than one
+   thread the inputs are spread across workers and each input is assembled
+   by a single job, otherwise large inputs are still split. */
+static bool assemble_batch(const char *manifest_path,
+                           const options_t *options, const cache_t *cache)
+{
+    batch_t batch;
+    if (!read_manifest(&batch, manifest_path)) {
+        return false;
+    }
+    bool is_assembled = false;
+    size_t workers_size = options->threads;
+    if (workers_size > batch.entries_size) {
+        workers_size = batch.entries_size;
+    }
+    /* a listing is only readable if the inputs are listed in order */
+    if (workers_size == 0 || options->listing != NULL) {
+        workers_size = 1;
+    }
+    batch_worker_t *workers = calloc(workers_size, sizeof(*workers));
+    if (workers == NULL) {
+        perror("allocating workers");
+        goto free_batch;
+    }
+
+    options_t file_options = *options;
+    file_options.is_stats = false;
+    if (workers_size > 1) {
+        file_options.threads = 1;
+    }
+    batch.options = &file_options;
+    batch.cache = cache;
+    atomic_init(&batch.next, 0);
+
+    double start = now();
+    for (size_t i = 0; i < workers_size; ++i) {
+        batch_worker_t *worker = &workers[i];
+        worker->batch = &batch;
+        assembly_init(&worker->assembly);
+        /* the build is only hashed once, each worker counts on its own */
+        if (cache != NULL) {
+            worker->cache = *cache;
+            worker->cache.hits = 0;
+            worker->cache.misses = 0;
+        }
+        /* inputs a worker could not be started for go to the others */
+        if (i > 0) {
+            worker->is_started = pthread_create(&worker->thread, NULL,
+                                                batch_work, worker) == 0;
+        }
+    }
+    batch_work(&workers[0]);
+
+    size_t failed_size = 0;
+    cache_t total;
+    cache_init(&total, NULL);
+    for (size_t i = 0; i < workers_size; ++i) {
+        batch_worker_t *worker = &workers[i];
+        if (worker->is_started) {
+            pthread_join(worker->thread, NULL);
+        }
+        failed_size += worker->failed_size;
+        total.hits += worker->cache.hits;
+        total.misses += worker->cache.misses;
+        assembly_fini(&worker->assembly);
+    }
+    if (options->is_stats) {
+        print_batch_stats(batch.entries_size, failed_size, now() - start,
+                          cache != NULL ? &total : NULL);
+    }
+    is_assembled = failed_size == 0;
+    free(workers);
+
+ free_batch:
+    batch_fini(&batch);
+    return is_assembled;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option OPTIONS[] = {
+        { "listing", no_argument, NULL, 'l' },
+        { "stats", no_argument, NULL, 's' },
+        { "cache", required_argument, NULL, 'C' },
+        { "batch", required_argument, NULL, 'b' },
+        { "run", optional_argument, NULL, 'r' },
+        { "huge-pages", no_argument, NULL, 'h' },
+        { "perf-map", no_argument, NULL, 'p' },
+        { "align-loops", optional_argument, NULL, 'a' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *output_path = NULL;
+    const char *manifest_path = NULL;
+    bool is_run = false;
+    bool is_dual_mapped = false;
+    bool is_perf_map = false;
+    options_t options;
+    options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    options.listing = NULL;
+    options.is_stats = false;
+    options.text_alignment = LAYOUT_PAGE_SIZE;
+    options.is_relocatable = false;
+    options.loop_alignment = 0;
+    cache_t cache;
+    cache_t *cache_used = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:cj:lo:", OPTIONS, NULL)) != -1) {
+        switch (opt) {
+        case 'b':
+            manifest_path = optarg;
+            break;
+        case 'r':
+            /* --run=memfd keeps every page either writable or executable */
+            is_run = true;
+            if (optarg != NULL && strcmp(optarg, "memfd") == 0) {
+                is_dual_mapped = true;
+            }
+            else if (optarg != NULL && strcmp(optarg, "mprotect") != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            /* the listing is large, only flush it in big blocks */
+            options.listing = stdout;
+            setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+            break;
+        case 's':
+            options.is_stats = true;
+            break;
+        case 'p':
+            is_perf_map = true;
+            break;
+        case 'c':
+            options.is_relocatable = true;
+            break;
+        case 'a':
+            /* a power of two up to the page size, 16 by default */
+            options.loop_alignment = 16;
+            if (optarg != NULL) {
+                options.loop_alignment = strtol(optarg, NULL, 10);
+            }
+            if (options.loop_alignment < 2
+                || options.loop_alignment > LAYOUT_PAGE_SIZE
+                || (options.loop_alignment & (options.loop_alignment - 1))) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+            /* lets the kernel back the text with huge pages */
+            options.text_alignment = LAYOUT_HUGE_PAGE_SIZE;
+            break;
+        case 'C':
+            if (!cache_init(&cache, optarg)) {
+                perror("hashing the assembler for --cache");
+                return EXIT_FAILURE;
+            }
+            cache_used = &cache;
+            break;
+        case 'j':
+            options.threads = strtol(optarg, NULL, 10);
+            if (options.threads < 1) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    bool is_batch = manifest_path != NULL;
+    bool has_output = !is_batch && !is_run;
+    if ((is_batch && is_run) || (is_run && options.is_relocatable)
+        || optind + (is_batch ? 0 : 1) != argc
+        || (output_path != NULL) != has_output) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    /* the listing is produced by the parse, so it bypasses the cache */
+    if (options.listing != NULL) {
+        cache_used = NULL;
+    }
+    int ret = EXIT_SUCCESS;
+    /* EYL_SCAN=scalar|sse2|avx2 overrides the tokenizer's instruction set */
+    if (!scan_select(getenv("EYL_SCAN"))) {
+        fprintf(stderr, "unsupported EYL_SCAN value\n");
         ret = EXIT_FAILURE;
-        goto ret;
-    }
-
-    Elf64_Ehdr header;
-    header.e_ident[EI_MAG0] = ELFMAG0;
-    header.e_ident[EI_MAG1] = ELFMAG1;
-    header.e_ident[EI_MAG2] = ELFMAG2;
-    header.e_ident[EI_MAG3] = ELFMAG3;
-    header.e_ident[EI_CLASS] = ELFCLASS64;
-    header.e_ident[EI_DATA] = ELFDATA2LSB;
-    header.e_ident[EI_VERSION] = EV_CURRENT;
-
-    header.e_type = ET_EXEC;
-    header.e_machine = EM_X86_64;
-    header.e_version = EV_CURRENT;
-    header.e_entry = 0x400000 + 120; /* Entry point virtual address */
-
-    header.e_phoff = 64; /* Program header table file offset */
-    header.e_shoff = 0; /* Section header table file offset */
-
-    header.e_flags = 0; /* Processor-specific flags */
-    header.e_ehsize = 64; /* ELF header size in bytes */
-    header.e_phentsize = 56; /* Program header table entry size */
-    header.e_phnum = 1; /* Program header table entry count */
-    header.e_shentsize = 64; /* Section header table entry size */
-    header.e_shnum = 0; /* Section header table entry count */
-    header.e_shstrndx = 0; /* Section header string table index */
-
-    Elf64_Phdr program_header;
-    program_header.p_type = PT_LOAD; /* Segment type */
-    program_header.p_flags = PF_R | PF_X; /* Segment flags */
-    program_header.p_offset = 0; /* Segment file offset */
-    program_header.p_vaddr = 0x400000; /* Segment virtual address */
-    program_header.p_paddr = 0x400000; /* Segment physical address */
-    program_header.p_filesz = 120 + machine_code_size; /* Segment size in file */
-    program_header.p_memsz = 120 + machine_code_size; /* Segment size in memory */
-    program_header.p_align = 4096; /* Segment alignment */
-
-    write(fd, &header, sizeof(header));
-    write(fd, &program_header, sizeof(program_header));
-    write(fd, machine_code, machine_code_size);
+        goto free_tables;
+    }
+    if (!assembler_build_tables()) {
+        fprintf(stderr, "building lookup tables failed\n");
+        ret = EXIT_FAILURE;
+        goto free_tables;
+    }
 
-    close(fd);
- ret:
+    if (is_batch) {
+        if (!assemble_batch(manifest_path, &options, cache_used)) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    else if (is_run) {
+        assembly_t assembly;
+        assembly_init(&assembly);
+        ret = run_file(&assembly, &options, argv[optind], is_dual_mapped,
+                       is_perf_map);
+        assembly_fini(&assembly);
+    }
+    else {
+        assembly_t assembly;
+        assembly_init(&assembly);
+        if (!assemble_file(&assembly, cache_used, &options, argv[optind],
+                           output_path)) {
+            ret = EXIT_FAILURE;
+        }
+        assembly_fini(&assembly);
+    }
+
+ free_tables:
+    assembler_free_tables();
     return ret;
 }
@@ -0,0 +1,181 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "optimize.h"
+
+/* C */
+#include <stdlib.h>
+
+static void delete_instruction(instruction_t *instruction)
+{
+    instruction->op = INS_DELETED;
+    instruction->size = 0;
+}
+
+/* returns whether the instruction only writes an immediate to a register */
+static bool is_register_mov(const instruction_t *instruction)
+{
+    return instruction->op == INS_FORM
+        && (INSTRUCTION_FORMS[instruction->form].flags & FORM_MOV_IMM)
+        && instruction->rm_mode == RM_REGISTER;
+}
+
+void peephole_optimize(instruction_buffer_t *const *buffers,
+                       size_t buffers_size)
+{
+    /* the previous mov if nothing (not even a label) follows it yet */
+    instruction_t *mov = NULL;
+    /* the previous branch if only labels follow it */
+    instruction_t *branch = NULL;
+    for (size_t b = 0; b < buffers_size; ++b) {
+        instruction_buffer_t *buffer = buffers[b];
+        for (size_t i = 0; i < buffer->size; ++i) {
+            instruction_t *instruction = &buffer->instructions[i];
+            switch (instruction->op) {
+            case INS_DELETED:
+                continue;
+            case INS_LABEL:
+                if (branch != NULL && branch->label == instruction->label) {
+                    delete_instruction(branch);
+                    branch = NULL;
+                }
+                mov = NULL;
+                continue;
+            case INS_FORM:
+                if (!is_register_mov(instruction)) {
+                    mov = NULL;
+                    branch = NULL;
+                    continue;
+                }
+                if (mov != NULL && mov->rm == instruction->rm) {
+                    delete_instruction(mov);
+                }
+                mov = instruction;
+                branch = NULL;
+                continue;
+            case INS_JMP:
+            case INS_JCC:
+                mov = NULL;
+                branch = instruction;
+                continue;
+            default:
+                mov = NULL;
+                branch = NULL;
+                continue;
+            }
+        }
+    }
+}
+
+/* Walks the stream backwards tracking whether the flags may be read before
+   they are next written, starting from the liveness at every label found so
+   far. Falling off the end leaves them dead and call leaves them live since
+   the other side is not known, other instructions follow their form's
+   flags. Returns whether the liveness at any label changed. When
+   is_selecting, movs of zero with dead flags after them are replaced. */
+static bool walk_flags(instruction_buffer_t *const *buffers,
+                       size_t buffers_size, bool *label_live,
+                       bool is_selecting)
+{
+    bool is_changed = false;
+    bool is_live = false;
+    for (size_t b = buffers_size; b-- > 0;) {
+        instruction_buffer_t *buffer = buffers[b];
+        for (size_t i = buffer->size; i-- > 0;) {
+            instruction_t *instruction = &buffer->instructions[i];
+            switch (instruction->op) {
+            case INS_LABEL:
+                if (label_live[instruction->label] != is_live) {
+                    label_live[instruction->label] = is_live;
+                    is_changed = true;
+                }
+                break;
+            case INS_FORM:
+                if (is_selecting && !is_live && is_register_mov(instruction)
+                    && instruction->immediate == 0) {
+                    instruction_set_zero(instruction);
+                }
+                {
+                    uint8_t flags = INSTRUCTION_FORMS[instruction->form].flags;
+                    if (flags & FORM_READS_FLAGS) {
+                        is_live = true;
+                    }
+                    else if (flags & FORM_SETS_FLAGS) {
+                        is_live = false;
+                    }
+                }
+                break;
+            case INS_JMP:
+                is_live = label_live[instruction->label];
+                break;
+            case INS_JCC:
+            case INS_CALL:
+                is_live = true;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    return is_changed;
+}
+
+bool select_encodings(instruction_buffer_t *const *buffers,
+                      size_t buffers_size, size_t labels_size)
+{
+    bool *label_live = calloc(labels_size + 1, sizeof(*label_live));
+    if (label_live == NULL) {
+        return false;
+    }
+    /* labels only ever become live, so this reaches a fixed point */
+    while (walk_flags(buffers, buffers_size, label_live, false)) {
+    }
+    walk_flags(buffers, buffers_size, label_live, true);
+    free(label_live);
+    return true;
+}
+
+bool align_loops(instruction_buffer_t *const *buffers, size_t buffers_size,
+                 size_t labels_size, uint8_t log2)
+{
+    /* the definition of every label seen so far */
+    instruction_t **labels = calloc(labels_size + 1, sizeof(*labels));
+    if (labels == NULL) {
+        return false;
+    }
+    for (size_t b = 0; b < buffers_size; ++b) {
+        instruction_buffer_t *buffer = buffers[b];
+        for (size_t i = 0; i < buffer->size; ++i) {
+            instruction_t *instruction = &buffer->instructions[i];
+            switch (instruction->op) {
+            case INS_LABEL:
+                labels[instruction->label] = instruction;
+                break;
+            case INS_JMP:
+            case INS_JCC:
+                if (labels[instruction->label] != NULL) {
+                    labels[instruction->label]->reg = log2;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    free(labels);
+    return true;
+}
@@ -0,0 +1,48 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#ifndef EYL_OPTIMIZE_H
+#define EYL_OPTIMIZE_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "encode.h"
+
+/* The passes see the buffers (in order) as one instruction stream, so the
+   result does not depend on how the input was split into jobs. They run
+   after labels are linked and before branches are relaxed. */
+
+/* deletes a mov that is overwritten by the next instruction and a jmp or jcc
+   to a label that immediately follows it */
+void peephole_optimize(instruction_buffer_t *const *buffers,
+                       size_t buffers_size);
+
+/* replaces mov reg, 0 with the shorter xor reg32, reg32 wherever the flags
+   it clobbers are not read before being set again, returns false if the
+   liveness could not be allocated */
+bool select_encodings(instruction_buffer_t *const *buffers,
+                      size_t buffers_size, size_t labels_size);
+
+/* aligns every label a later jmp or jcc goes back to, the head of a loop,
+   to 1 << log2 so the loop body starts on a fetch boundary, returns false if
+   the labels could not be allocated */
+bool align_loops(instruction_buffer_t *const *buffers, size_t buffers_size,
+                 size_t labels_size, uint8_t log2);
+
+#endif
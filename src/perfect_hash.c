@@ -0,0 +1,260 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "perfect_hash.h"
+
+/* C */
+#include <stdlib.h>
+#include <string.h>
+
+#define GOLDEN 0x9e3779b97f4a7c15ULL
+#define SEED_ATTEMPTS 64
+#define DISPLACEMENT_ATTEMPTS (1U << 16)
+
+/* splitmix64 finalizer */
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/* packs 0 to 8 bytes into a word using overlapping loads, the overlapping
+   bytes are the same so or'ing them together is harmless */
+static uint64_t pack(const char *p, size_t size)
+{
+    if (size >= 4) {
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + size - 4, 4);
+        return lo | ((uint64_t) hi << (8 * (size - 4)));
+    }
+    if (size == 0) {
+        return 0;
+    }
+    return (uint64_t) (uint8_t) p[0]
+        | ((uint64_t) (uint8_t) p[size / 2] << (8 * (size / 2)))
+        | ((uint64_t) (uint8_t) p[size - 1] << (8 * (size - 1)));
+}
+
+static uint64_t hash_name(const char *name, size_t size, uint64_t seed)
+{
+    uint64_t h = seed ^ (size * GOLDEN);
+    while (size > 8) {
+        uint64_t word;
+        memcpy(&word, name, 8);
+        h = mix(h ^ word);
+        name += 8;
+        size -= 8;
+    }
+    return mix(h ^ pack(name, size));
+}
+
+static uint64_t slot_index(uint64_t hash, uint32_t displacement, uint64_t mask)
+{
+    return mix(hash ^ (displacement * GOLDEN)) & mask;
+}
+
+void perfect_hash_init(perfect_hash_t *table)
+{
+    memset(table, 0, sizeof(*table));
+}
+
+void perfect_hash_fini(perfect_hash_t *table)
+{
+    free(table->keys);
+    free(table->slots);
+    free(table->displacements);
+    memset(table, 0, sizeof(*table));
+}
+
+bool perfect_hash_add(perfect_hash_t *table, const char *name, int32_t value)
+{
+    size_t size = strlen(name);
+    if (size == 0 || size > UINT32_MAX || value < 0) {
+        return false;
+    }
+    if (table->keys_size == table->keys_capacity) {
+        size_t capacity = table->keys_capacity ? table->keys_capacity * 2 : 16;
+        perfect_hash_slot_t *keys = realloc(table->keys,
+                                            capacity * sizeof(*keys));
+        if (keys == NULL) {
+            return false;
+        }
+        table->keys = keys;
+        table->keys_capacity = capacity;
+    }
+    perfect_hash_slot_t *key = &table->keys[table->keys_size];
+    key->name = name;
+    key->word = pack(name, size < 8 ? size : 8);
+    key->size = size;
+    key->value = value;
+    ++table->keys_size;
+    return true;
+}
+
+static bool place_bucket(perfect_hash_t *table, const size_t *members,
+                         size_t count, const uint64_t *hashes,
+                         uint32_t displacement)
+{
+    size_t placed = 0;
+    for (; placed < count; ++placed) {
+        size_t key = members[placed];
+        uint64_t slot = slot_index(hashes[key], displacement,
+                                   table->slot_mask);
+        if (table->slots[slot].size != 0) {
+            break;
+        }
+        table->slots[slot] = table->keys[key];
+    }
+    if (placed == count) {
+        return true;
+    }
+    while (placed > 0) {
+        --placed;
+        uint64_t slot = slot_index(hashes[members[placed]], displacement,
+                                   table->slot_mask);
+        table->slots[slot].size = 0;
+    }
+    return false;
+}
+
+static bool is_duplicate(const perfect_hash_slot_t *a,
+                         const perfect_hash_slot_t *b)
+{
+    return a->size == b->size && memcmp(a->name, b->name, a->size) == 0;
+}
+
+bool perfect_hash_build(perfect_hash_t *table)
+{
+    size_t keys_size = table->keys_size;
+    size_t slots_size = 8;
+    while (slots_size < keys_size + keys_size / 4) {
+        slots_size *= 2;
+    }
+    size_t buckets_size = 1;
+    while (buckets_size * 4 < keys_size) {
+        buckets_size *= 2;
+    }
+
+    free(table->slots);
+    free(table->displacements);
+    table->slots = calloc(slots_size, sizeof(*table->slots));
+    table->displacements = calloc(buckets_size,
+                                  sizeof(*table->displacements));
+    table->slot_mask = slots_size - 1;
+    table->bucket_mask = buckets_size - 1;
+
+    uint64_t *hashes = malloc((keys_size + 1) * sizeof(*hashes));
+    size_t *members = malloc((keys_size + 1) * sizeof(*members));
+    size_t *bucket_start = malloc((buckets_size + 1) * sizeof(*bucket_start));
+    size_t *bucket_cursor = malloc(buckets_size * sizeof(*bucket_cursor));
+
+    bool built = false;
+    if (table->slots == NULL || table->displacements == NULL
+        || hashes == NULL || members == NULL || bucket_start == NULL
+        || bucket_cursor == NULL) {
+        goto free_scratch;
+    }
+
+    for (uint64_t attempt = 1; attempt <= SEED_ATTEMPTS; ++attempt) {
+        table->seed = mix(attempt * GOLDEN);
+        memset(table->slots, 0, slots_size * sizeof(*table->slots));
+        memset(table->displacements, 0,
+               buckets_size * sizeof(*table->displacements));
+
+        /* counting sort the keys by bucket */
+        memset(bucket_start, 0, (buckets_size + 1) * sizeof(*bucket_start));
+        for (size_t i = 0; i < keys_size; ++i) {
+            perfect_hash_slot_t *key = &table->keys[i];
+            hashes[i] = hash_name(key->name, key->size, table->seed);
+            ++bucket_start[(hashes[i] & table->bucket_mask) + 1];
+        }
+        size_t largest_bucket = 0;
+        for (size_t b = 0; b < buckets_size; ++b) {
+            if (bucket_start[b + 1] > largest_bucket) {
+                largest_bucket = bucket_start[b + 1];
+            }
+            bucket_start[b + 1] += bucket_start[b];
+            bucket_cursor[b] = bucket_start[b];
+        }
+        for (size_t i = 0; i < keys_size; ++i) {
+            members[bucket_cursor[hashes[i] & table->bucket_mask]++] = i;
+        }
+
+        /* place the largest buckets first while the table is still empty */
+        bool placed_all = true;
+        for (size_t count = largest_bucket; count > 0 && placed_all; --count) {
+            for (size_t b = 0; b < buckets_size && placed_all; ++b) {
+                const size_t *bucket = &members[bucket_start[b]];
+                if (bucket_start[b + 1] - bucket_start[b] != count) {
+                    continue;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    for (size_t j = i + 1; j < count; ++j) {
+                        if (hashes[bucket[i]] == hashes[bucket[j]]
+                            && is_duplicate(&table->keys[bucket[i]],
+                                            &table->keys[bucket[j]])) {
+                            goto free_scratch;
+                        }
+                    }
+                }
+                uint32_t displacement = 0;
+                while (displacement < DISPLACEMENT_ATTEMPTS
+                       && !place_bucket(table, bucket, count, hashes,
+                                        displacement)) {
+                    ++displacement;
+                }
+                if (displacement == DISPLACEMENT_ATTEMPTS) {
+                    placed_all = false;
+                }
+                table->displacements[b] = displacement;
+            }
+        }
+        if (placed_all) {
+            built = true;
+            break;
+        }
+    }
+
+ free_scratch:
+    free(bucket_cursor);
+    free(bucket_start);
+    free(members);
+    free(hashes);
+    return built;
+}
+
+int32_t perfect_hash_find(const perfect_hash_t *table,
+                          const char *start, size_t size)
+{
+    uint64_t hash = hash_name(start, size, table->seed);
+    uint32_t displacement = table->displacements[hash & table->bucket_mask];
+    const perfect_hash_slot_t *slot =
+        &table->slots[slot_index(hash, displacement, table->slot_mask)];
+    if (size == 0 || slot->size != size
+        || slot->word != pack(start, size < 8 ? size : 8)) {
+        return -1;
+    }
+    if (size > 8 && memcmp(slot->name + 8, start + 8, size - 8) != 0) {
+        return -1;
+    }
+    return slot->value;
+}
@@ -0,0 +1,59 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_PERFECT_HASH_H
+#define EYL_PERFECT_HASH_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A static name -> value map with a guaranteed single probe per lookup. Keys
+   are added once, then perfect_hash_build picks a seed and a displacement per
+   bucket (hash, displace and compress) so that every key owns its own slot. */
+
+typedef struct {
+    const char *name;
+    uint64_t word; /* first (up to) 8 bytes of the name, zero padded */
+    uint32_t size;
+    int32_t value;
+} perfect_hash_slot_t;
+
+typedef struct {
+    perfect_hash_slot_t *keys;
+    size_t keys_size;
+    size_t keys_capacity;
+
+    perfect_hash_slot_t *slots;
+    uint32_t *displacements;
+    uint64_t seed;
+    uint64_t slot_mask;
+    uint64_t bucket_mask;
+} perfect_hash_t;
+
+void perfect_hash_init(perfect_hash_t *table);
+void perfect_hash_fini(perfect_hash_t *table);
+
+/* name must outlive the table, it is not copied */
+bool perfect_hash_add(perfect_hash_t *table, const char *name, int32_t value);
+bool perfect_hash_build(perfect_hash_t *table);
+
+/* returns the value for the name, or -1 if it is not in the table */
+int32_t perfect_hash_find(const perfect_hash_t *table,
+                          const char *start, size_t size);
+
+#endif
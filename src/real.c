@@ -0,0 +1,465 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include "real.h"
+
+/* C */
+#include <locale.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX */
+#include <pthread.h>
+
+#include "real_powers.h"
+
+/* A literal is read into at most 19 significant decimal digits, which
+   always fit in 64 bits, and a power of ten. Most are then converted with
+   one of two fast paths: Clinger's, when the digits and the power of ten
+   are both exact in the format so one rounded multiply or divide is
+   correct, or Eisel and Lemire's, which multiplies the digits by a 128-bit
+   approximation of the power of ten (see real_powers.c) and knows when
+   that approximation is too close to a halfway point to round correctly.
+   A literal with more digits is converted with the first 19 and with the
+   first 19 rounded up, if both give the same value that is the answer.
+   Only when neither fast path decides, which is very rare, does strtod (or
+   strtof) read the literal, in the C locale whatever the program set. */
+
+/* the most significant digits that always fit in 64 bits */
+#define DIGITS_CAPACITY 19
+
+/* longer literals are shortened for strtod, no more than 768 significant
+   digits decide the rounding of a binary64 */
+#define SLOW_DIGITS_CAPACITY 800
+#define SLOW_LITERAL_CAPACITY (SLOW_DIGITS_CAPACITY + 32)
+
+/* an IEEE 754 binary interchange format */
+typedef struct {
+    int mantissa_bits; /* without the implicit bit */
+    int minimum_exponent; /* of a normal number, minus one */
+    int infinite_power; /* the biased exponent of infinity */
+    int sign_bit;
+    /* only powers of ten in this range can give exact halfway points */
+    int min_round_to_even;
+    int max_round_to_even;
+    /* 10^q rounds to zero or infinity past these */
+    int smallest_power_of_ten;
+    int largest_power_of_ten;
+    /* Clinger's fast path */
+    int max_fast_power;
+    uint64_t max_fast_mantissa;
+} format_t;
+
+static const format_t BINARY64 = {
+    .mantissa_bits = 52,
+    .minimum_exponent = -1023,
+    .infinite_power = 0x7ff,
+    .sign_bit = 63,
+    .min_round_to_even = -4,
+    .max_round_to_even = 23,
+    .smallest_power_of_ten = -342,
+    .largest_power_of_ten = 308,
+    .max_fast_power = 22,
+    .max_fast_mantissa = (uint64_t) 2 << 52
+};
+
+static const format_t BINARY32 = {
+    .mantissa_bits = 23,
+    .minimum_exponent = -127,
+    .infinite_power = 0xff,
+    .sign_bit = 31,
+    .min_round_to_even = -17,
+    .max_round_to_even = 10,
+    .smallest_power_of_ten = -65,
+    .largest_power_of_ten = 38,
+    .max_fast_power = 10,
+    .max_fast_mantissa = (uint64_t) 2 << 23
+};
+
+/* mantissa * 10^exponent */
+typedef struct {
+    uint64_t mantissa;
+    int64_t exponent;
+    bool is_negative;
+    bool is_truncated; /* more significant digits than mantissa holds */
+    /* for the slow path, the value is 0.D * 10^(point + written_exponent)
+       where D are the digits from the first significant one up to
+       digits_end, without the decimal point */
+    const char *digits;
+    const char *digits_end;
+    int64_t point;
+    int64_t written_exponent; /* after e */
+} decimal_t;
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/* Reads the literal into decimal, returns its end or NULL if it has no
+   digits. An exponent without digits is not part of the literal, a huge
+   one only has to stay huge. */
+static const char *parse_decimal(const char *start, const char *end,
+                                 decimal_t *decimal)
+{
+    const char *current = start;
+    decimal->is_negative = false;
+    if (current != end && (*current == '-' || *current == '+')) {
+        decimal->is_negative = *current == '-';
+        ++current;
+    }
+
+    const char *digits = current;
+    uint64_t mantissa = 0;
+    while (current != end && is_digit(*current)) {
+        mantissa = mantissa * 10 + (*current - '0');
+        ++current;
+    }
+    const char *integer_end = current;
+    const char *fraction = NULL;
+    int64_t exponent = 0;
+    if (current != end && *current == '.') {
+        ++current;
+        fraction = current;
+        while (current != end && is_digit(*current)) {
+            mantissa = mantissa * 10 + (*current - '0');
+            ++current;
+        }
+        exponent = -(current - fraction);
+    }
+    const char *digits_end = current;
+    size_t digits_size = (integer_end - digits)
+        + (fraction != NULL ? digits_end - fraction : 0);
+    if (digits_size == 0) {
+        return NULL;
+    }
+
+    int64_t written_exponent = 0;
+    if (current != end && (*current == 'e' || *current == 'E')) {
+        const char *power = current + 1;
+        bool is_negative = false;
+        if (power != end && (*power == '-' || *power == '+')) {
+            is_negative = *power == '-';
+            ++power;
+        }
+        if (power != end && is_digit(*power)) {
+            while (power != end && is_digit(*power)) {
+                if (written_exponent < 0x10000) {
+                    written_exponent = written_exponent * 10
+                        + (*power - '0');
+                }
+                ++power;
+            }
+            if (is_negative) {
+                written_exponent = -written_exponent;
+            }
+            current = power;
+        }
+    }
+
+    /* leading zeros are not significant */
+    const char *significant = digits;
+    while (significant != digits_end
+           && (*significant == '0' || *significant == '.')) {
+        digits_size -= *significant == '0';
+        ++significant;
+    }
+    decimal->digits = significant;
+    decimal->digits_end = digits_end;
+    decimal->point = significant <= integer_end ? integer_end - significant
+                                                : -(significant - fraction);
+    decimal->written_exponent = written_exponent;
+    decimal->is_truncated = digits_size > DIGITS_CAPACITY;
+    if (decimal->is_truncated) {
+        /* the mantissa wrapped, read the first digits again and scale by
+           where they end relative to the decimal point */
+        mantissa = 0;
+        const char *digit = significant;
+        for (size_t i = 0; i < DIGITS_CAPACITY; ++digit) {
+            if (*digit != '.') {
+                mantissa = mantissa * 10 + (*digit - '0');
+                ++i;
+            }
+        }
+        exponent = digit <= integer_end ? integer_end - digit
+                                        : -(digit - fraction);
+    }
+    decimal->mantissa = mantissa;
+    decimal->exponent = exponent + written_exponent;
+    return current;
+}
+
+/* a binary number as its mantissa and biased exponent */
+typedef struct {
+    uint64_t mantissa;
+    int power; /* -1 if it could not be found */
+} binary_t;
+
+/* Eisel and Lemire's algorithm for mantissa * 10^exponent, from
+   "Number Parsing at a Gigabyte per Second" and fast_float. */
+static binary_t compute_binary(const format_t *format, int64_t exponent,
+                               uint64_t mantissa)
+{
+    binary_t answer = { 0, 0 };
+    if (mantissa == 0 || exponent < format->smallest_power_of_ten) {
+        return answer;
+    }
+    if (exponent > format->largest_power_of_ten) {
+        answer.power = format->infinite_power;
+        return answer;
+    }
+
+    int leading_zeros = __builtin_clzll(mantissa);
+    mantissa <<= leading_zeros;
+
+    /* the bits after the mantissa, the implicit bit and a rounding bit are
+       only uncertain if they are all ones, then the lower half of the
+       power is needed too */
+    const uint64_t *power = REAL_POWERS_OF_FIVE[exponent
+                                                - REAL_SMALLEST_POWER_OF_TEN];
+    unsigned __int128 product = (unsigned __int128) mantissa * power[0];
+    uint64_t high = product >> 64;
+    uint64_t low = product;
+    uint64_t precision_mask = UINT64_MAX >> (format->mantissa_bits + 3);
+    if ((high & precision_mask) == precision_mask) {
+        unsigned __int128 second = (unsigned __int128) mantissa * power[1];
+        uint64_t second_high = second >> 64;
+        low += second_high;
+        if (second_high > low) {
+            ++high;
+        }
+        /* the product may still be off by one in the last place, which
+           only matters outside of where both halves are exact */
+        if (low == UINT64_MAX && (exponent < -27 || exponent > 55)) {
+            answer.power = -1;
+            return answer;
+        }
+    }
+
+    int upper_bit = high >> 63;
+    int shift = upper_bit + 64 - format->mantissa_bits - 3;
+    answer.mantissa = high >> shift;
+    /* floor(log2(10^exponent)) + 63 */
+    int power_of_two = (int) (((152170 + 65536) * exponent) >> 16) + 63;
+    answer.power = power_of_two + upper_bit - leading_zeros
+        - format->minimum_exponent;
+
+    if (answer.power <= 0) {
+        /* subnormal, or zero */
+        if (-answer.power + 1 >= 64) {
+            answer.mantissa = 0;
+            answer.power = 0;
+            return answer;
+        }
+        answer.mantissa >>= -answer.power + 1;
+        answer.mantissa += answer.mantissa & 1;
+        answer.mantissa >>= 1;
+        answer.power =
+            answer.mantissa < (uint64_t) 1 << format->mantissa_bits ? 0 : 1;
+        return answer;
+    }
+
+    /* an exact halfway point rounds to even instead of up */
+    if (low <= 1 && exponent >= format->min_round_to_even
+        && exponent <= format->max_round_to_even
+        && (answer.mantissa & 3) == 1
+        && answer.mantissa << shift == high) {
+        answer.mantissa &= ~(uint64_t) 1;
+    }
+    answer.mantissa += answer.mantissa & 1;
+    answer.mantissa >>= 1;
+    if (answer.mantissa >= (uint64_t) 2 << format->mantissa_bits) {
+        answer.mantissa = (uint64_t) 1 << format->mantissa_bits;
+        ++answer.power;
+    }
+    answer.mantissa &= ~((uint64_t) 1 << format->mantissa_bits);
+    if (answer.power >= format->infinite_power) {
+        answer.mantissa = 0;
+        answer.power = format->infinite_power;
+    }
+    return answer;
+}
+
+/* the binary of the decimal unless neither fast path can tell, then the
+   power is -1 */
+static binary_t fast_binary(const format_t *format, const decimal_t *decimal)
+{
+    binary_t answer = compute_binary(format, decimal->exponent,
+                                     decimal->mantissa);
+    if (decimal->is_truncated && answer.power >= 0) {
+        /* the digits that were left out only raise the value */
+        binary_t above = compute_binary(format, decimal->exponent,
+                                        decimal->mantissa + 1);
+        if (above.power != answer.power
+            || above.mantissa != answer.mantissa) {
+            answer.power = -1;
+        }
+    }
+    return answer;
+}
+
+/* returns true if the mantissa and the power of ten are both exact in the
+   format, so one rounded multiply or divide gives the nearest value */
+static bool is_fast(const format_t *format, const decimal_t *decimal)
+{
+    return !decimal->is_truncated
+        && decimal->exponent >= -format->max_fast_power
+        && decimal->exponent <= format->max_fast_power
+        && decimal->mantissa <= format->max_fast_mantissa;
+}
+
+/* Writes the decimal as a literal strtod reads the same way to literal,
+   which has room for SLOW_LITERAL_CAPACITY bytes: its significant digits,
+   only the first SLOW_DIGITS_CAPACITY of them followed by a 1 if any later
+   one is not zero, and the exponent. There is no decimal point, so no
+   locale can read it differently. */
+static void write_slow_literal(char *literal, const decimal_t *decimal)
+{
+    char *current = literal;
+    if (decimal->is_negative) {
+        *current++ = '-';
+    }
+    size_t digits_size = 0;
+    bool is_sticky = false;
+    for (const char *digit = decimal->digits; digit != decimal->digits_end;
+         ++digit) {
+        if (*digit == '.') {
+            continue;
+        }
+        if (digits_size < SLOW_DIGITS_CAPACITY) {
+            *current++ = *digit;
+            ++digits_size;
+        }
+        else {
+            is_sticky |= *digit != '0';
+        }
+    }
+    if (is_sticky) {
+        *current++ = '1';
+        ++digits_size;
+    }
+    sprintf(current, "e%lld",
+            (long long) (decimal->point + decimal->written_exponent)
+            - (long long) digits_size);
+}
+
+static locale_t c_locale;
+static pthread_once_t c_locale_once = PTHREAD_ONCE_INIT;
+
+/* if this fails, the literals without a decimal point still read the same
+   in the program's locale */
+static void create_c_locale(void)
+{
+    c_locale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+}
+
+/* converts the decimal to the bits of the format, returns REAL_OK or
+   REAL_OVERFLOW */
+static real_status_t convert(const format_t *format, const decimal_t *decimal,
+                             uint64_t *bits)
+{
+    binary_t binary = fast_binary(format, decimal);
+    if (binary.power >= 0) {
+        *bits = binary.mantissa
+            | (uint64_t) binary.power << format->mantissa_bits
+            | (uint64_t) decimal->is_negative << format->sign_bit;
+    }
+    else {
+        char literal[SLOW_LITERAL_CAPACITY];
+        write_slow_literal(literal, decimal);
+        pthread_once(&c_locale_once, create_c_locale);
+        if (format == &BINARY64) {
+            double value = c_locale != (locale_t) 0
+                ? strtod_l(literal, NULL, c_locale) : strtod(literal, NULL);
+            memcpy(bits, &value, sizeof(value));
+        }
+        else {
+            float value = c_locale != (locale_t) 0
+                ? strtof_l(literal, NULL, c_locale) : strtof(literal, NULL);
+            uint32_t value_bits;
+            memcpy(&value_bits, &value, sizeof(value));
+            *bits = value_bits;
+        }
+        binary.power = (*bits >> format->mantissa_bits)
+            & format->infinite_power;
+    }
+    return binary.power == format->infinite_power ? REAL_OVERFLOW : REAL_OK;
+}
+
+/* Clinger's fast path is tried first, its powers of ten are exact */
+real_status_t real_parse_binary64(const char *start, const char *end,
+                                  double *value, const char **real_end)
+{
+    static const double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    decimal_t decimal;
+    *real_end = parse_decimal(start, end, &decimal);
+    if (*real_end == NULL) {
+        *real_end = start;
+        return REAL_EMPTY;
+    }
+    if (is_fast(&BINARY64, &decimal)) {
+        double result = decimal.mantissa;
+        if (decimal.exponent < 0) {
+            result /= POWERS_OF_TEN[-decimal.exponent];
+        }
+        else {
+            result *= POWERS_OF_TEN[decimal.exponent];
+        }
+        *value = decimal.is_negative ? -result : result;
+        return REAL_OK;
+    }
+    uint64_t bits;
+    real_status_t status = convert(&BINARY64, &decimal, &bits);
+    memcpy(value, &bits, sizeof(*value));
+    return status;
+}
+
+real_status_t real_parse_binary32(const char *start, const char *end,
+                                  float *value, const char **real_end)
+{
+    static const float POWERS_OF_TEN[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+    };
+    decimal_t decimal;
+    *real_end = parse_decimal(start, end, &decimal);
+    if (*real_end == NULL) {
+        *real_end = start;
+        return REAL_EMPTY;
+    }
+    if (is_fast(&BINARY32, &decimal)) {
+        float result = decimal.mantissa;
+        if (decimal.exponent < 0) {
+            result /= POWERS_OF_TEN[-decimal.exponent];
+        }
+        else {
+            result *= POWERS_OF_TEN[decimal.exponent];
+        }
+        *value = decimal.is_negative ? -result : result;
+        return REAL_OK;
+    }
+    uint64_t bits;
+    real_status_t status = convert(&BINARY32, &decimal, &bits);
+    uint32_t value_bits = bits;
+    memcpy(value, &value_bits, sizeof(*value));
+    return status;
+}
@@ -0,0 +1,49 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_REAL_H
+#define EYL_REAL_H
+
+/* C */
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    REAL_OK,
+    REAL_EMPTY,   /* no digits */
+    REAL_OVERFLOW /* too large for the format, the value is infinite */
+} real_status_t;
+
+/* Parses the decimal real literal at start, which ends before end: an
+   optional sign, digits with an optional decimal point and an optional
+   exponent after e or E, like -4.84143144246472090e+00. The value is the
+   nearest binary64 (or binary32) one, ties to even, which is what strtod
+   (or strtof) gives in the C locale, whatever locale the program uses. It
+   stops at the first byte that is not part of the literal and sets
+   *real_end to it, and only sets *value if there are digits. */
+real_status_t real_parse_binary64(const char *start, const char *end,
+                                  double *value, const char **real_end);
+real_status_t real_parse_binary32(const char *start, const char *end,
+                                  float *value, const char **real_end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_REAL_POWERS_H
+#define EYL_REAL_POWERS_H
+
+/* C */
+#include <stdint.h>
+
+#define REAL_SMALLEST_POWER_OF_TEN (-342)
+#define REAL_LARGEST_POWER_OF_TEN 308
+#define REAL_POWERS_OF_FIVE_SIZE                                              \
+    (REAL_LARGEST_POWER_OF_TEN - REAL_SMALLEST_POWER_OF_TEN + 1)
+
+/* the powers of five the parser of real literals multiplies by, starting at
+   5^REAL_SMALLEST_POWER_OF_TEN */
+extern const uint64_t REAL_POWERS_OF_FIVE[REAL_POWERS_OF_FIVE_SIZE][2];
+
+#endif
@@ -0,0 +1,185 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "scan.h"
+
+/* C */
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef const char *(*scan_find_t)(const char *, const char *, unsigned);
+
+static uint8_t classify(uint8_t c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+        return SCAN_LETTER;
+    }
+    if (c >= '0' && c <= '9') {
+        return SCAN_DIGIT;
+    }
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        return SCAN_SPACE;
+    }
+    return SCAN_OTHER;
+}
+
+static const char *find_scalar(const char *start, const char *end,
+                               unsigned classes)
+{
+    while (start != end && (classify(*start) & classes) == 0) {
+        ++start;
+    }
+    return start;
+}
+
+#if defined(__x86_64__)
+
+/* bytes in [lo, hi] have their bit set, using a signed compare after biasing
+   the range down to start at -128 */
+#define SSE2_IN_RANGE(x, lo, hi)                                              \
+    _mm_cmplt_epi8(_mm_add_epi8(x, _mm_set1_epi8((char) (0x80 - (lo)))),     \
+                   _mm_set1_epi8((char) (-128 + (hi) - (lo) + 1)))
+
+static const char *find_sse2(const char *start, const char *end,
+                             unsigned classes)
+{
+    while (end - start >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) start);
+        __m128i letter = _mm_or_si128(
+            _mm_or_si128(SSE2_IN_RANGE(x, 'a', 'z'), SSE2_IN_RANGE(x, 'A', 'Z')),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+        __m128i digit = SSE2_IN_RANGE(x, '0', '9');
+        __m128i space = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                         _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+            _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')),
+                         _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+        unsigned letter_mask = _mm_movemask_epi8(letter);
+        unsigned digit_mask = _mm_movemask_epi8(digit);
+        unsigned space_mask = _mm_movemask_epi8(space);
+        unsigned other_mask = ~(letter_mask | digit_mask | space_mask) & 0xffff;
+
+        unsigned mask = 0;
+        mask |= (classes & SCAN_LETTER) ? letter_mask : 0;
+        mask |= (classes & SCAN_DIGIT) ? digit_mask : 0;
+        mask |= (classes & SCAN_SPACE) ? space_mask : 0;
+        mask |= (classes & SCAN_OTHER) ? other_mask : 0;
+        if (mask != 0) {
+            return start + __builtin_ctz(mask);
+        }
+        start += 16;
+    }
+    return find_scalar(start, end, classes);
+}
+
+#define AVX2_IN_RANGE(x, lo, hi)                                              \
+    _mm256_cmpgt_epi8(                                                        \
+        _mm256_set1_epi8((char) (-128 + (hi) - (lo) + 1)),                    \
+        _mm256_add_epi8(x, _mm256_set1_epi8((char) (0x80 - (lo)))))
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *start, const char *end,
+                             unsigned classes)
+{
+    while (end - start >= 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) start);
+        __m256i letter = _mm256_or_si256(
+            _mm256_or_si256(AVX2_IN_RANGE(x, 'a', 'z'),
+                            AVX2_IN_RANGE(x, 'A', 'Z')),
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+        __m256i digit = AVX2_IN_RANGE(x, '0', '9');
+        __m256i space = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+        uint32_t letter_mask = _mm256_movemask_epi8(letter);
+        uint32_t digit_mask = _mm256_movemask_epi8(digit);
+        uint32_t space_mask = _mm256_movemask_epi8(space);
+        uint32_t other_mask = ~(letter_mask | digit_mask | space_mask);
+
+        uint32_t mask = 0;
+        mask |= (classes & SCAN_LETTER) ? letter_mask : 0;
+        mask |= (classes & SCAN_DIGIT) ? digit_mask : 0;
+        mask |= (classes & SCAN_SPACE) ? space_mask : 0;
+        mask |= (classes & SCAN_OTHER) ? other_mask : 0;
+        if (mask != 0) {
+            return start + __builtin_ctz(mask);
+        }
+        start += 32;
+    }
+    return find_sse2(start, end, classes);
+}
+
+#endif
+
+typedef enum { SCAN_ISA_SCALAR, SCAN_ISA_SSE2, SCAN_ISA_AVX2 } scan_isa_t;
+
+static scan_find_t selected_find = find_scalar;
+
+bool scan_select(const char *isa)
+{
+    scan_isa_t widest = SCAN_ISA_SCALAR;
+#if defined(__x86_64__)
+    widest = __builtin_cpu_supports("avx2") ? SCAN_ISA_AVX2 : SCAN_ISA_SSE2;
+#endif
+
+    scan_isa_t wanted = widest;
+    if (isa != NULL) {
+        if (strcmp(isa, "scalar") == 0) {
+            wanted = SCAN_ISA_SCALAR;
+        }
+        else if (strcmp(isa, "sse2") == 0) {
+            wanted = SCAN_ISA_SSE2;
+        }
+        else if (strcmp(isa, "avx2") == 0) {
+            wanted = SCAN_ISA_AVX2;
+        }
+        else {
+            return false;
+        }
+    }
+    if (wanted > widest) {
+        return false;
+    }
+
+    switch (wanted) {
+    case SCAN_ISA_SCALAR:
+        selected_find = find_scalar;
+        break;
+#if defined(__x86_64__)
+    case SCAN_ISA_SSE2:
+        selected_find = find_sse2;
+        break;
+    case SCAN_ISA_AVX2:
+        selected_find = find_avx2;
+        break;
+#else
+    default:
+        break;
+#endif
+    }
+    return true;
+}
+
+const char *scan_find(const char *start, const char *end, unsigned classes)
+{
+    return selected_find(start, end, classes);
+}
@@ -0,0 +1,39 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_SCAN_H
+#define EYL_SCAN_H
+
+/* C */
+#include <stdbool.h>
+
+/* Character classes for the tokenizer. Every byte is in exactly one class. */
+typedef enum {
+    SCAN_LETTER = 1 << 0, /* a-z, A-Z, _ */
+    SCAN_DIGIT = 1 << 1,  /* 0-9 */
+    SCAN_SPACE = 1 << 2,  /* space, \t, \n, \r */
+    SCAN_OTHER = 1 << 3,
+} scan_class_t;
+
+/* picks the widest implementation the processor supports, or the one named by
+   isa ("scalar", "sse2" or "avx2") if it is not NULL, returns false if the
+   named one is unknown or unsupported */
+bool scan_select(const char *isa);
+
+/* returns the first byte in [start, end) whose class is in classes, or end */
+const char *scan_find(const char *start, const char *end, unsigned classes);
+
+#endif
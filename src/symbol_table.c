@@ -0,0 +1,120 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#include "symbol_table.h"
+
+/* C */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* FNV-1a */
+static uint64_t hash_name(const char *name, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (uint8_t) name[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void symbol_table_init(symbol_table_t *table)
+{
+    memset(table, 0, sizeof(*table));
+}
+
+void symbol_table_fini(symbol_table_t *table)
+{
+    free(table->symbols);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+void symbol_table_clear(symbol_table_t *table)
+{
+    if (table->slots != NULL) {
+        memset(table->slots, 0,
+               (table->slots_mask + 1) * sizeof(*table->slots));
+    }
+    table->symbols_size = 0;
+}
+
+static bool grow_slots(symbol_table_t *table)
+{
+    size_t slots_size = table->slots == NULL ? 64
+                                             : (table->slots_mask + 1) * 2;
+    uint32_t *slots = calloc(slots_size, sizeof(*slots));
+    if (slots == NULL) {
+        return false;
+    }
+    for (size_t id = 0; id < table->symbols_size; ++id) {
+        symbol_t *symbol = &table->symbols[id];
+        size_t slot = hash_name(symbol->name, symbol->name_size);
+        while (slots[slot & (slots_size - 1)] != 0) {
+            ++slot;
+        }
+        slots[slot & (slots_size - 1)] = id + 1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slots_mask = slots_size - 1;
+    return true;
+}
+
+uint32_t symbol_table_intern(symbol_table_t *table,
+                             const char *name, size_t size)
+{
+    /* keep the load factor at most one half */
+    if (table->slots == NULL
+        || (table->symbols_size + 1) * 2 > table->slots_mask + 1) {
+        if (!grow_slots(table)) {
+            return SYMBOL_NONE;
+        }
+    }
+
+    size_t slot = hash_name(name, size) & table->slots_mask;
+    while (table->slots[slot] != 0) {
+        uint32_t id = table->slots[slot] - 1;
+        symbol_t *symbol = &table->symbols[id];
+        if (symbol->name_size == size
+            && memcmp(symbol->name, name, size) == 0) {
+            return id;
+        }
+        slot = (slot + 1) & table->slots_mask;
+    }
+
+    if (table->symbols_size == table->symbols_capacity) {
+        size_t capacity = table->symbols_capacity
+            ? table->symbols_capacity * 2 : 64;
+        symbol_t *symbols = realloc(table->symbols,
+                                    capacity * sizeof(*symbols));
+        if (symbols == NULL) {
+            return SYMBOL_NONE;
+        }
+        table->symbols = symbols;
+        table->symbols_capacity = capacity;
+    }
+    uint32_t id = table->symbols_size;
+    symbol_t *symbol = &table->symbols[id];
+    symbol->name = name;
+    symbol->name_size = size;
+    symbol->definitions = 0;
+    symbol->flags = 0;
+    ++table->symbols_size;
+    table->slots[slot] = id + 1;
+    return id;
+}
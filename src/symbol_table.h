@@ -0,0 +1,58 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_SYMBOL_TABLE_H
+#define EYL_SYMBOL_TABLE_H
+
+/* C */
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYMBOL_NONE UINT32_MAX
+
+/* flags of a symbol, exported to other object files, or defined in one */
+#define SYMBOL_GLOBAL 1
+#define SYMBOL_EXTERN 2
+
+/* the name points into the source and is not copied */
+typedef struct {
+    const char *name;
+    uint32_t name_size;
+    uint32_t definitions;
+    uint32_t flags;
+} symbol_t;
+
+/* Interns names to dense ids in the order they are first seen. */
+typedef struct {
+    symbol_t *symbols;
+    size_t symbols_size;
+    size_t symbols_capacity;
+    uint32_t *slots; /* symbol id + 1, 0 if empty */
+    size_t slots_mask;
+} symbol_table_t;
+
+void symbol_table_init(symbol_table_t *table);
+void symbol_table_fini(symbol_table_t *table);
+
+/* removes every symbol, keeping the memory for the next names */
+void symbol_table_clear(symbol_table_t *table);
+
+/* returns the id of the name, adding it if it is new, or SYMBOL_NONE if the
+   table could not grow */
+uint32_t symbol_table_intern(symbol_table_t *table,
+                             const char *name, size_t size);
+
+#endif
@@ -0,0 +1,322 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+
+#include "symbols.h"
+
+/* C */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX */
+#include <elf.h>
+
+void symbols_init(symbols_t *symbols)
+{
+    memset(symbols, 0, sizeof(*symbols));
+}
+
+void symbols_fini(symbols_t *symbols)
+{
+    free(symbols->symbols);
+    free(symbols->bytes);
+    memset(symbols, 0, sizeof(*symbols));
+}
+
+static bool add_symbol(symbols_t *symbols, uint32_t label, uint8_t section,
+                       uint64_t address)
+{
+    if (symbols->symbols_size == symbols->symbols_capacity) {
+        size_t capacity = symbols->symbols_capacity
+            ? symbols->symbols_capacity * 2 : 64;
+        label_symbol_t *grown = realloc(symbols->symbols,
+                                        capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return false;
+        }
+        symbols->symbols = grown;
+        symbols->symbols_capacity = capacity;
+    }
+    label_symbol_t *symbol = &symbols->symbols[symbols->symbols_size++];
+    symbol->label = label;
+    symbol->section = section;
+    symbol->address = address;
+    symbol->size = 0;
+    return true;
+}
+
+/* the buffers of a section are in address order, so their labels are too */
+bool symbols_collect(symbols_t *symbols, const assembly_t *assembly)
+{
+    symbols->symbols_size = 0;
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        size_t first = symbols->symbols_size;
+        for (size_t b = 0; b < assembly->section_buffers_sizes[s]; ++b) {
+            const instruction_buffer_t *buffer =
+                assembly->section_buffers[s][b];
+            for (size_t i = 0; i < buffer->size; ++i) {
+                const instruction_t *instruction = &buffer->instructions[i];
+                if (instruction->op != INS_LABEL) {
+                    continue;
+                }
+                uint32_t label = instruction->label;
+                if (!add_symbol(symbols, label, s,
+                                assembly->label_addresses[label])) {
+                    return false;
+                }
+            }
+        }
+
+        const section_layout_t *section = &assembly->layout.sections[s];
+        uint64_t end = section->address + section->size;
+        for (size_t i = symbols->symbols_size; i-- > first;) {
+            label_symbol_t *symbol = &symbols->symbols[i];
+            symbol->size = end - symbol->address;
+            end = symbol->address;
+        }
+    }
+
+    /* only an object file can have labels that are defined elsewhere */
+    for (size_t i = 0; i < assembly->labels.symbols_size; ++i) {
+        if (assembly->labels.symbols[i].definitions == 0
+            && !add_symbol(symbols, i, SECTION_UNDEFINED, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* appends the name to the string table, returns its offset */
+static uint32_t add_name(char *table, size_t *size, const char *name,
+                         size_t name_size)
+{
+    uint32_t offset = *size;
+    memcpy(table + offset, name, name_size);
+    table[offset + name_size] = '\0';
+    *size += name_size + 1;
+    return offset;
+}
+
+static bool is_global(const assembly_t *assembly,
+                      const label_symbol_t *symbol)
+{
+    return symbol->label == assembly->entry_label
+        || symbol->section == SECTION_UNDEFINED
+        || (assembly->labels.symbols[symbol->label].flags & SYMBOL_GLOBAL);
+}
+
+/* In an object file the sections have their own addresses (see
+   layout_object), so the section of a label is known from its address. A
+   rel32 to a label in another section, or defined elsewhere, is left to the
+   linker with a relocation in the .rela section of the section it is in,
+   rel32s within a section were already encoded. */
+static bool is_relocated(const assembly_t *assembly, size_t section,
+                         uint32_t label)
+{
+    return assembly->is_relocatable
+        && assembly->label_addresses[label] / LAYOUT_SECTION_SPACING
+           != section;
+}
+
+/* Global symbols must come after every local one, so the table is
+   written in two passes. An executable only describes the sections it has
+   a segment for, a label in an empty one is absolute. An object file
+   describes every section, with symbols relative to their section, and has
+   a .rela section for each section that needs relocations. */
+bool symbols_encode(symbols_t *symbols, const assembly_t *assembly,
+                    elf_builder_t *elf)
+{
+    static const char *const RELA_NAMES[SECTION_BSS] = {
+        ".rela.text", ".rela.rodata", ".rela.data"
+    };
+    const layout_t *layout = &assembly->layout;
+    bool is_relocatable = assembly->is_relocatable;
+
+    size_t relocations_sizes[SECTION_BSS] = { 0 };
+    for (size_t s = 0; s < SECTION_BSS; ++s) {
+        for (size_t b = 0; b < assembly->section_buffers_sizes[s]; ++b) {
+            const instruction_buffer_t *buffer =
+                assembly->section_buffers[s][b];
+            for (size_t i = 0; i < buffer->size; ++i) {
+                const instruction_t *instruction = &buffer->instructions[i];
+                relocations_sizes[s] +=
+                    instruction_label_field(instruction) != 0
+                    && is_relocated(assembly, s, instruction->label);
+            }
+        }
+    }
+
+    uint16_t indices[SECTIONS_SIZE + 1];
+    for (size_t s = 0; s < SECTIONS_SIZE; ++s) {
+        indices[s] = layout->elf_sections[s] != 0 ? layout->elf_sections[s]
+                                                  : SHN_ABS;
+    }
+    indices[SECTION_UNDEFINED] = SHN_UNDEF;
+
+    /* the relocations, the symbols and their names are in one piece */
+    size_t names_size = 1;
+    for (size_t i = 0; i < symbols->symbols_size; ++i) {
+        const symbol_t *label =
+            &assembly->labels.symbols[symbols->symbols[i].label];
+        names_size += label->name_size + 1;
+    }
+    uint64_t relocations_size = 0;
+    for (size_t s = 0; s < SECTION_BSS; ++s) {
+        relocations_size += relocations_sizes[s] * sizeof(Elf64_Rela);
+    }
+    uint64_t symtab_size = (1 + symbols->symbols_size) * sizeof(Elf64_Sym);
+    uint8_t *bytes = calloc(1, relocations_size + symtab_size + names_size);
+    if (bytes == NULL) {
+        return false;
+    }
+    free(symbols->bytes);
+    symbols->bytes = bytes;
+    symbols->bytes_size = relocations_size + symtab_size + names_size;
+
+    /* the symbol table index of every label, for the relocations */
+    uint32_t *label_indices = NULL;
+    if (is_relocatable) {
+        label_indices = malloc((assembly->labels.symbols_size + 1)
+                               * sizeof(*label_indices));
+        if (label_indices == NULL) {
+            return false;
+        }
+    }
+
+    size_t rela_indices[SECTION_BSS];
+    Elf64_Rela *rela_entries[SECTION_BSS];
+    uint8_t *relocations = bytes;
+    for (size_t s = 0; s < SECTION_BSS; ++s) {
+        rela_indices[s] = 0;
+        if (relocations_sizes[s] == 0) {
+            continue;
+        }
+        uint64_t size = relocations_sizes[s] * sizeof(Elf64_Rela);
+        rela_indices[s] = elf_builder_add_section(elf, RELA_NAMES[s],
+                                                  SHT_RELA, SHF_INFO_LINK, 8,
+                                                  size, ELF_NO_SEGMENT);
+        if (rela_indices[s] == ELF_NO_SECTION) {
+            continue;
+        }
+        elf_section_t *section = &elf->sections[rela_indices[s]];
+        section->entry_size = sizeof(Elf64_Rela);
+        section->info = indices[s];
+        section->data = relocations;
+        rela_entries[s] = (Elf64_Rela *) relocations;
+        relocations += size;
+    }
+    size_t symtab_index = elf_builder_add_section(elf, ".symtab",
+                                                  SHT_SYMTAB, 0, 8,
+                                                  symtab_size,
+                                                  ELF_NO_SEGMENT);
+    size_t strtab_index = elf_builder_add_section(elf, ".strtab",
+                                                  SHT_STRTAB, 0, 1,
+                                                  names_size,
+                                                  ELF_NO_SEGMENT);
+    bool is_full = symtab_index == ELF_NO_SECTION
+        || strtab_index == ELF_NO_SECTION;
+    for (size_t s = 0; s < SECTION_BSS; ++s) {
+        is_full |= rela_indices[s] == ELF_NO_SECTION;
+    }
+    if (is_full) {
+        free(label_indices);
+        errno = ENOBUFS;
+        return false;
+    }
+
+    Elf64_Sym *symtab = (Elf64_Sym *) relocations;
+    char *strtab = (char *) relocations + symtab_size;
+    size_t name_offset = 1;
+    size_t entries_size = 1;
+    size_t locals_size = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        bool is_global_pass = pass == 1;
+        if (is_global_pass) {
+            locals_size = entries_size;
+        }
+        for (size_t i = 0; i < symbols->symbols_size; ++i) {
+            const label_symbol_t *symbol = &symbols->symbols[i];
+            if (is_global(assembly, symbol) != is_global_pass) {
+                continue;
+            }
+            const symbol_t *label = &assembly->labels.symbols[symbol->label];
+            unsigned char type = STT_NOTYPE;
+            if (symbol->section == SECTION_TEXT) {
+                type = STT_FUNC;
+            }
+            else if (symbol->section != SECTION_UNDEFINED) {
+                type = STT_OBJECT;
+            }
+            uint64_t value = symbol->address;
+            if (is_relocatable && symbol->section != SECTION_UNDEFINED) {
+                value -= layout->sections[symbol->section].address;
+            }
+            if (label_indices != NULL) {
+                label_indices[symbol->label] = entries_size;
+            }
+            Elf64_Sym *entry = &symtab[entries_size++];
+            entry->st_name = add_name(strtab, &name_offset, label->name,
+                                      label->name_size);
+            entry->st_info = ELF64_ST_INFO(is_global_pass ? STB_GLOBAL
+                                                          : STB_LOCAL,
+                                           type);
+            entry->st_shndx = indices[symbol->section];
+            entry->st_value = value;
+            entry->st_size = symbol->size;
+        }
+    }
+    elf_section_t *section = &elf->sections[symtab_index];
+    section->entry_size = sizeof(Elf64_Sym);
+    section->link = strtab_index;
+    section->info = locals_size;
+    section->data = symtab;
+    elf->sections[strtab_index].data = strtab;
+
+    for (size_t s = 0; s < SECTION_BSS; ++s) {
+        if (rela_indices[s] == 0) {
+            continue;
+        }
+        elf->sections[rela_indices[s]].link = symtab_index;
+        Elf64_Rela *relocation = rela_entries[s];
+        uint64_t section_address = layout->sections[s].address;
+        for (size_t b = 0; b < assembly->section_buffers_sizes[s]; ++b) {
+            const instruction_buffer_t *buffer =
+                assembly->section_buffers[s][b];
+            uint64_t address = buffer->address;
+            for (size_t i = 0; i < buffer->size; ++i) {
+                const instruction_t *instruction = &buffer->instructions[i];
+                address += instruction_length(instruction);
+                uint8_t field = instruction_label_field(instruction);
+                uint32_t label = instruction->label;
+                if (field == 0 || !is_relocated(assembly, s, label)) {
+                    continue;
+                }
+                /* a branch to a function in another module may go through
+                   its PLT entry */
+                bool is_branch = instruction->op != INS_FORM;
+                uint32_t type = is_branch ? R_X86_64_PLT32 : R_X86_64_PC32;
+                relocation->r_offset = address - field - section_address;
+                relocation->r_info = ELF64_R_INFO(label_indices[label], type);
+                relocation->r_addend = (int64_t) instruction->displacement
+                    - field;
+                ++relocation;
+            }
+        }
+    }
+    free(label_indices);
+    return true;
+}
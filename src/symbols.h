@@ -0,0 +1,67 @@
+/*******************************************************************************
+Copyright 2015 Jonathan Eyolfson
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+#ifndef EYL_SYMBOLS_H
+#define EYL_SYMBOLS_H
+
+/* C */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "assembler.h"
+
+/* the section of a label that is only declared, in an object file */
+#define SECTION_UNDEFINED SECTIONS_SIZE
+
+/* a label with the section it was defined in, it reaches up to the next
+   label in the section or the end of the section */
+typedef struct {
+    uint32_t label;
+    uint8_t section;
+    uint64_t address;
+    uint64_t size;
+} label_symbol_t;
+
+/* The labels of a laid out assembly, in address order within each section
+   and then the undefined ones, and the sections of the output file that
+   name them for debuggers, profilers and linkers: the .rela sections of an
+   object file, a .symtab and its .strtab, none of which are loaded. */
+typedef struct {
+    label_symbol_t *symbols;
+    size_t symbols_size;
+    size_t symbols_capacity;
+
+    /* the contents of those sections, one after another */
+    uint8_t *bytes;
+    uint64_t bytes_size;
+} symbols_t;
+
+void symbols_init(symbols_t *symbols);
+void symbols_fini(symbols_t *symbols);
+
+/* collects the labels of the parsed assembly, returns false if they could
+   not be allocated */
+bool symbols_collect(symbols_t *symbols, const assembly_t *assembly);
+
+/* builds the tables for the collected labels and adds their sections to
+   elf, a copy of the builder of the assembly's layout that is laid out
+   again afterwards, returns false and sets errno if they could not be
+   allocated or elf has no room for their sections */
+bool symbols_encode(symbols_t *symbols, const assembly_t *assembly,
+                    elf_builder_t *elf);
+
+#endif
@@ -0,0 +1,7 @@
+_start:
+    call set_status
+    mov rax, 60
+    syscall
+set_status:
+    mov rdi, 42
+    ret
@@ -0,0 +1,24 @@
+.rodata
+message:
+    .ascii "hello, world\n"
+
+.data
+status:
+    .long 3
+
+.bss
+buffer:
+    .zero 4096
+
+.text
+_start:
+    mov rax, 1
+    mov rdi, 1
+    lea rsi, [message]
+    mov rdx, 13
+    syscall
+    mov edi, [status]
+    mov [buffer + 8], rdi
+    mov rdi, [buffer + 8]
+    mov rax, 60
+    syscall
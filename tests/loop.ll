@@ -0,0 +1,11 @@
+_start:
+    mov rcx, 100
+    mov rax, 0
+.p2align 4
+loop:
+    add rax, rcx
+    sub rcx, 1
+    jne loop
+    mov rdi, rax
+    mov rax, 60
+    syscall